@@ -1,16 +1,14 @@
 #include "Button.h"
 
-#define BUTTON_STATE_DOWN_BIT 0 // kedy je tlacidlo stlacene 0 = LOW | 1 = HIGH
-#define BUTTON_STATE_OLD_LEVEL_BIT 1 //predosly level pinu 0 = LOW | 1 = HIGH
-#define BUTTON_STATE_PRESSED_BIT 2   //aktualny stav pressed 0 = "UP" | 1 = "DOWN"
-#define BUTTON_STATE_AFTER_DEBOUNCE_BIT 3 //internal 0 = on debounce | 1 
-
 #define BUTTON_ON_LONG_READED_BIT 0
 #define BUTTON_ON_VLONG_READED_BIT 1
 /////////////// DebounceButton ///////////////
 
+ButtonBank *DebounceButton::bank = nullptr;
+
 DebounceButton::DebounceButton(uint8_t pin, uint8_t pin_mode = INPUT_PULLUP, bool down = LOW, uint16_t debounce_time = 20u) {
     _pin = pin; //set pin number
+    _bankMask = 0;
     pinMode(pin, pin_mode); //set pin mode
     
     _state = (down == HIGH) ? _BV(BUTTON_STATE_DOWN_BIT) : 0;
@@ -21,9 +19,10 @@ DebounceButton::DebounceButton(uint8_t pin, uint8_t pin_mode = INPUT_PULLUP, boo
 
 
 void DebounceButton::start() {
+    _state2 = 0x00;
+    if (_state & _BV(BUTTON_STATE_BANK_BIT)) return; //debounced by the bank
     _debounce_timer = millis();
     if (digitalRead(_pin) == HIGH) _state |= _BV(BUTTON_STATE_OLD_LEVEL_BIT);
-    _state2 = 0x00;
 }
 
 bool DebounceButton::pressed() {
@@ -31,7 +30,18 @@ bool DebounceButton::pressed() {
 }
 
 bool DebounceButton::update() {
-    if (digitalRead(_pin) == HIGH) {
+    if (_state & _BV(BUTTON_STATE_BANK_BIT)) { //debounced state from the bank - no pin reading, no timer
+        if (bank->pressed() & _bankMask)
+            _state |= _BV(BUTTON_STATE_PRESSED_BIT);
+        else
+            _state &= ~_BV(BUTTON_STATE_PRESSED_BIT);
+        return false;
+    }
+    return debounce(digitalRead(_pin) == HIGH);
+}
+
+bool DebounceButton::debounce(bool high) {
+    if (high) {
         if (_state & _BV(BUTTON_STATE_OLD_LEVEL_BIT)) {
             
             //bolo HIGH a teraz je HIGH
@@ -82,23 +92,41 @@ bool DebounceButton::update() {
 
 ////////////////// RealButton //////////////////
 
-#define BUTTON_STATE_ON_PRESS_BP        0
-#define BUTTON_STATE_ON_RELEASE_BP      1
-#define BUTTON_STATE_ON_LONG_BP         2
-#define BUTTON_STATE_ON_VLONG_BP        3
-#define BUTTON_STATE_ON_CLICK_BP        4
-#define BUTTON_STATE_ON_DOUBLE_BP       5
-#define BUTTON_STATE_ON_LONGCLICK_BP    6
-#define BUTTON_STATE_ON_VLONGCLICK_BP   7
+#define BUTTON_STATE_ON_PRESS_BP        BUTTON_EVENT_PRESS
+#define BUTTON_STATE_ON_RELEASE_BP      BUTTON_EVENT_RELEASE
+#define BUTTON_STATE_ON_LONG_BP         BUTTON_EVENT_LONG
+#define BUTTON_STATE_ON_VLONG_BP        BUTTON_EVENT_VLONG
+#define BUTTON_STATE_ON_CLICK_BP        BUTTON_EVENT_CLICK
+#define BUTTON_STATE_ON_DOUBLE_BP       BUTTON_EVENT_DOUBLE
+#define BUTTON_STATE_ON_LONGCLICK_BP    BUTTON_EVENT_LONGCLICK
+#define BUTTON_STATE_ON_VLONGCLICK_BP   BUTTON_EVENT_VLONGCLICK
 
 #define BUTTON_TIMER_STATE_LONG_BP      0
 #define BUTTON_TIMER_STATE_DOUBLE_BP    1
+#define BUTTON_TIMER_STATE_ON_LONG_BP   2 //ON_LONG was generated in this press
+#define BUTTON_TIMER_STATE_ON_VLONG_BP  3 //ON_VLONG was generated in this press
 
 
-RealButton::RealButton(uint8_t pin, uint8_t mode, bool down, uint16_t debouncetime) : DebounceButton(pin, mode, down, debouncetime) {
+EventButton::EventButton(uint8_t pin, uint8_t mode, bool down, uint16_t debouncetime) : DebounceButton(pin, mode, down, debouncetime) {
     _realState = 0;
-    _timerState = 0;
     _oldPressed = false;
+    _bankIndex = 0;
+}
+
+void EventButton::event(uint8_t type) {
+    if (_state & _BV(BUTTON_STATE_TIMER_BIT))
+        bank->push(_bankIndex, type); //in the timer interrupt - queued with the time, delivered by ButtonBank::deliver()
+    else
+        _realState |= _BV(type);
+}
+
+void EventButton::clearEvents() {
+    _realState = 0;
+    if (_state & _BV(BUTTON_STATE_TIMER_BIT)) bank->discard(_bankIndex); //queued events of the button
+}
+
+RealButton::RealButton(uint8_t pin, uint8_t mode, bool down, uint16_t debouncetime) : EventButton(pin, mode, down, debouncetime) {
+    _timerState = 0;
     longTime = BUTTON_LONG_TIME;
     veryLongTime = BUTTON_VLONG_TIME;
     dblPressTime = BUTTON_TIMER_MAX_DOUBLE_PRESS_TIME;
@@ -114,55 +142,58 @@ void RealButton::start(bool down) {
 
 }
 
-bool RealButton::onPress(bool reset) {
+bool EventButton::onPress(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_PRESS_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_PRESS_BP);
     return value;
 }
 
-bool RealButton::onRelease(bool reset) {
+bool EventButton::onRelease(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_RELEASE_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_RELEASE_BP);
     return value;
 }
 
-bool RealButton::onClick(bool reset) {
+bool EventButton::onClick(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_CLICK_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_CLICK_BP);
     return value;
 }
 
-bool RealButton::onLong(bool reset) {
+bool EventButton::onLong(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_LONG_BP);
     if (value) {
+      uint8_t sreg = SREG; //_state2 is cleared in the timer interrupt
+      cli();
       if (_state2 & _BV(BUTTON_ON_LONG_READED_BIT))
         value = false;
       else
         _state2 |= _BV(BUTTON_ON_LONG_READED_BIT);
+      SREG = sreg;
     }
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_LONG_BP);
     return value;
 }
 
-bool RealButton::onLongClick(bool reset) {
+bool EventButton::onLongClick(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_LONGCLICK_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_LONGCLICK_BP);
     return value;
 }
 
-bool RealButton::onVLong(bool reset) {
+bool EventButton::onVLong(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_VLONG_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_VLONG_BP);
     return value;
 }
 
-bool RealButton::onVLongClick(bool reset) {
+bool EventButton::onVLongClick(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_VLONGCLICK_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_VLONGCLICK_BP);
     return value;
 }
 
-bool RealButton::onDouble(bool reset) {
+bool EventButton::onDouble(bool reset) {
     bool value = _realState & _BV(BUTTON_STATE_ON_DOUBLE_BP);
     if(reset) _realState &= ~_BV(BUTTON_STATE_ON_DOUBLE_BP);
     return value;
@@ -170,55 +201,77 @@ bool RealButton::onDouble(bool reset) {
 
 bool  RealButton::reset(uint8_t what) {
     if (what == BUTTON_RESET_ALL) {
+        uint8_t sreg = SREG; //the timers are updated in the timer interrupt
+        cli();
         _longTimer = 0;
         _dblTimer = 0;
-        _realState = 0;
         _timerState = 0;
+        clearEvents();
+        SREG = sreg;
         update();
     }
     return false; //temporary
 }
 
+void RealButton::handler(EventButton *button, uint8_t operation) {
+    RealButton *real = static_cast<RealButton *>(button);
+    if (operation == BUTTON_BANK_RESET) real->reset();
+    else real->sample();
+}
+
 bool RealButton::isDebouncing() {
     return !(_state & _BV(BUTTON_STATE_AFTER_DEBOUNCE_BIT));
 }
 
 bool RealButton::update() {
+    if (_state & _BV(BUTTON_STATE_TIMER_BIT)) return false; //updated in the timer interrupt
+    return sample();
+}
+
+bool RealButton::sample() {
     DebounceButton::update();
+    return events();
+}
+
+bool RealButton::events() {
     if (_oldPressed) { //predtym BOLO STLACENE
         
         if (pressed()) {     //a stale JE STLACENE
             if (_timerState & _BV(BUTTON_TIMER_STATE_LONG_BP)) {  //je zapnuty timer long
-                if (uint16_t(millis()) - _longTimer > longTime) //ak je DLHO STLACENE
-                    _realState |= _BV(BUTTON_STATE_ON_LONG_BP);
-
-                if (uint16_t(millis()) - _longTimer > veryLongTime) //ak je VELMI DLHO STLACENE
-                    _realState |= _BV(BUTTON_STATE_ON_VLONG_BP);
+                if ((uint16_t(millis()) - _longTimer > longTime) && !(_timerState & _BV(BUTTON_TIMER_STATE_ON_LONG_BP))) { //ak je DLHO STLACENE
+                    _timerState |= _BV(BUTTON_TIMER_STATE_ON_LONG_BP); //once in the press
+                    event(BUTTON_STATE_ON_LONG_BP);
+                }
+
+                if ((uint16_t(millis()) - _longTimer > veryLongTime) && !(_timerState & _BV(BUTTON_TIMER_STATE_ON_VLONG_BP))) { //ak je VELMI DLHO STLACENE
+                    _timerState |= _BV(BUTTON_TIMER_STATE_ON_VLONG_BP);
+                    event(BUTTON_STATE_ON_VLONG_BP);
+                }
             }
                  
         } else {             //a uz NIE JE STLACENE
-            _realState |= _BV(BUTTON_STATE_ON_RELEASE_BP); //nastav "on release"
+            event(BUTTON_STATE_ON_RELEASE_BP); //nastav "on release"
             _state2 = 0x00; //reset state Readed LongClick a VLongClick
             if (_timerState & _BV(BUTTON_TIMER_STATE_LONG_BP)) { //ak je zapnuty timer long
                 if (uint16_t(millis()) - _longTimer < longTime) 
                     // ak sa uvolnilo pred logTime nastavi sa udalost ON_CLICK
-                    _realState |= _BV(BUTTON_STATE_ON_CLICK_BP);
+                    event(BUTTON_STATE_ON_CLICK_BP);
                     
                 else if (uint16_t(millis()) - _longTimer < veryLongTime) 
                     // ak sa uvolnilo pred verylogTime nastavi sa udalost ON_LONGCLICK
-                    _realState |= _BV(BUTTON_STATE_ON_LONGCLICK_BP);
+                    event(BUTTON_STATE_ON_LONGCLICK_BP);
                 
                 else 
                     // nastavi sa ON_VLONGCLICK
-                    _realState |= _BV(BUTTON_STATE_ON_VLONGCLICK_BP);
+                    event(BUTTON_STATE_ON_VLONGCLICK_BP);
             }
                 
-            _timerState &= ~ _BV(BUTTON_TIMER_STATE_LONG_BP); //vypni timer
+            _timerState &= ~(_BV(BUTTON_TIMER_STATE_LONG_BP) | _BV(BUTTON_TIMER_STATE_ON_LONG_BP) | _BV(BUTTON_TIMER_STATE_ON_VLONG_BP)); //vypni timer
             _oldPressed = false; //nastav old pressed na UVOLNENE
         }
     } else {          // predtym NEBOLO STLACENE
         if (pressed()) { // a teraz JE STLACENE
-            _realState |= _BV(BUTTON_STATE_ON_PRESS_BP); //nastav "on press"
+            event(BUTTON_STATE_ON_PRESS_BP); //nastav "on press"
             _timerState |= _BV(BUTTON_TIMER_STATE_LONG_BP); //zapni timer long
             _longTimer = millis();
             _oldPressed = true;
@@ -260,7 +313,7 @@ bool RealButton::updateDouble() {
                 qn_double = 0;
                 _dblTimer = 0;
                 _timerState &= ~ _BV(BUTTON_TIMER_STATE_DOUBLE_BP);
-                _realState |= _BV(BUTTON_STATE_ON_DOUBLE_BP);
+                event(BUTTON_STATE_ON_DOUBLE_BP);
             }
             break;
     }
@@ -8,11 +8,20 @@
 #ifndef BUTTON_H
 #define BUTTON_H
 #include "Arduino.h"
+#include "ButtonBank.h"
 
 #define BUTTON_DEBOUNCE_TIME 20u //default cas debouncingu
 #define BUTTON_LONG_TIME     1000u //default long time form long timer
 #define BUTTON_VLONG_TIME    3000u //default vlong time form long timer
 
+// bits of DebounceButton::_state (also set by ButtonBank and GongInput)
+#define BUTTON_STATE_DOWN_BIT 0 // kedy je tlacidlo stlacene 0 = LOW | 1 = HIGH
+#define BUTTON_STATE_OLD_LEVEL_BIT 1 //predosly level pinu 0 = LOW | 1 = HIGH
+#define BUTTON_STATE_PRESSED_BIT 2   //aktualny stav pressed 0 = "UP" | 1 = "DOWN"
+#define BUTTON_STATE_AFTER_DEBOUNCE_BIT 3 //internal 0 = on debounce | 1 
+#define BUTTON_STATE_BANK_BIT 4 //1 = debounced by the ButtonBank
+#define BUTTON_STATE_TIMER_BIT 5 //1 = updated in the timer interrupt of the ButtonBank, events are queued
+
 class DebounceButton {
     public:
         /// @brief Constructor + initialization
@@ -35,16 +44,27 @@ class DebounceButton {
 
         /// @brief Time of debouncing
         uint16_t debounceTime;
+
+        /// @brief Bank of the buttons debounced in one pass (see ButtonBank::add())
+        static ButtonBank *bank;
     
     protected:
-        
-    
+        friend class ButtonBank;
+
+        /// @brief Debouncing of the pin level (read by update() or by FastButton)
+        /// @param high true - the pin is HIGH
+        /// @return true - debouncing in progress
+        bool debounce(bool high);
+
+        /// @brief The button is debounced by the bank - no pin reading
+        bool banked() { return _state & _BV(BUTTON_STATE_BANK_BIT); }
     
         uint8_t _pin; //pin number
         uint8_t _state; //bit0 - down state 0 - LOW, 1 - HIGH; bit1 - old pin level 0 - LOW, 1 - HIGH
         uint8_t _state2;//bit-0 OnLong readed
     private:
         uint16_t _debounce_timer; //internal debouncing timer
+        uint16_t _bankMask;       //bit mask of the button in the bank, 0 - not in the bank
 };
 
 // parametre funkcie reset
@@ -54,31 +74,26 @@ class DebounceButton {
 #define BUTTON_RESET_LONG       0x04
 #define BUTTON_RESET_VERY_LONG  0x08
 
+// events of EventButton (bit numbers; also the type of the ButtonEvent)
+#define BUTTON_EVENT_PRESS      0
+#define BUTTON_EVENT_RELEASE    1
+#define BUTTON_EVENT_LONG       2
+#define BUTTON_EVENT_VLONG      3
+#define BUTTON_EVENT_CLICK      4
+#define BUTTON_EVENT_DOUBLE     5
+#define BUTTON_EVENT_LONGCLICK  6
+#define BUTTON_EVENT_VLONGCLICK 7
+
 #define BUTTON_TIMER_MIN_DOUBLE_TIME    60u //mimimal duration in ms - press/release for double click 
 #define BUTTON_TIMER_MAX_DOUBLE_PRESS_TIME 200u
 #define BUTTON_TIMER_MAX_DOUBLE_RELEASE_TIME 200u
 
-class RealButton : public DebounceButton {
+/// @brief Button with the events (onPress, onClick...) - the events are generated by the derived class
+///        (RealButton, PolicyButton) and set here or queued in the ButtonBank
+class EventButton : public DebounceButton {
     public:
+    EventButton(uint8_t pin, uint8_t mode, bool down, uint16_t debouncetime);
 
-    uint16_t longTime;
-    uint16_t veryLongTime;
-    uint16_t dblPressTime;
-    uint16_t dblReleaseTime;
-    
-
-    /// @brief Constructor + initialization
-    /// @param pin Pin number
-    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
-    /// @param pressed Button "down" on state: LOW (default) | HIGH
-    /// @param debouncetime time in ms (20ms default)
-    RealButton(uint8_t pin, uint8_t mode = INPUT_PULLUP, bool down = LOW, uint16_t debouncetime = BUTTON_DEBOUNCE_TIME);
-    
-    
-    /// @brief inicializuje tlacitko
-    /// @param down pociatocna inicializacia true - tlacitko stlacene, false - tlacitko nestlacene 
-    void start(bool down = false);
-    
     /// @brief Udalost sa generuje: V okamihu stlacenia tlacidla
     /// @return true - bolo prave stlacene
     bool onPress(bool reset = true);
@@ -111,6 +126,41 @@ class RealButton : public DebounceButton {
     /// @return true - Po dvojkliku (dvojklik je definovany casmi dblpressTime, dblreleaseTime)
     bool onDouble(bool reset = true);
 
+ protected:
+    friend class ButtonBank;
+
+    void event(uint8_t type);   //sets the event or queues it in the bank
+    void clearEvents();         //clears the events and the queued events (interrupts disabled)
+
+    /// @brief The button is updated in the timer interrupt of the bank
+    bool timed() { return _state & _BV(BUTTON_STATE_TIMER_BIT); }
+
+    uint8_t  _realState; //statusy jednotlivych udalosti
+    uint8_t  _bankIndex; //index of the button in the events of the bank
+    bool _oldPressed;     //predosly stav pressed
+};
+
+class RealButton : public EventButton {
+    public:
+
+    uint16_t longTime;
+    uint16_t veryLongTime;
+    uint16_t dblPressTime;
+    uint16_t dblReleaseTime;
+    
+
+    /// @brief Constructor + initialization
+    /// @param pin Pin number
+    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
+    /// @param pressed Button "down" on state: LOW (default) | HIGH
+    /// @param debouncetime time in ms (20ms default)
+    RealButton(uint8_t pin, uint8_t mode = INPUT_PULLUP, bool down = LOW, uint16_t debouncetime = BUTTON_DEBOUNCE_TIME);
+    
+    
+    /// @brief inicializuje tlacitko
+    /// @param down pociatocna inicializacia true - tlacitko stlacene, false - tlacitko nestlacene 
+    void start(bool down = false);
+    
     /// @brief Updatovanie stavu tlacitka. Udalostne metody len vracaju stavy, ktore sa nastavili v tejto procedure
     /// @return 
     bool update();
@@ -127,12 +177,18 @@ class RealButton : public DebounceButton {
     /// @brief Returns double-click progress status
     /// @return true - double click analyzing in progres0s, false - idle
     bool isUpdateDouble(); //prebieha spracovanie dvojkliku
+ protected:
+    bool events();              //generates the events from the debounced state (after DebounceButton::update())
+
  private:
+    friend class ButtonBank;
+    
+    bool sample();              //state update (from update() or from the timer interrupt of the bank)
+    static void handler(EventButton *button, uint8_t operation); //sample / reset from the bank
+
     uint16_t _longTimer; //timer pre "long" a "veryLong"
     uint16_t _dblTimer;  //timer pre doubleClick
-    uint8_t  _realState; //statusy jednotlivych udalosti
     
-    bool _oldPressed;     //predosly stav pressed
     uint8_t _timerState;  //statusy zapnutia timerov b0 = _longTimer running, b1=_dblTimers running
     uint8_t qn_double;    //cislo stavu pre dvojklik (stavy automatu)
 
@@ -0,0 +1,168 @@
+/*
+ * ButtonBank
+ *
+ * Debouncing of all buttons on VPORTA and VPORTB in one pass.
+ *
+ * file   : ButtonBank.cpp
+ */
+
+#include "ButtonBank.h"
+#include "Button.h"
+
+uint16_t ButtonBank::add(uint8_t pin, uint8_t mode, bool down) {
+  uint8_t port = digitalPinToPort(pin);
+  if ((port != PA) && (port != PB)) return 0;
+
+  uint16_t mask = (uint16_t)digitalPinToBitMask(pin) << ((port == PB) ? 8 : 0);
+  pinMode(pin, mode);
+  _mask |= mask;
+  if (down == LOW) 
+    _activeLow |= mask;
+  else
+    _activeLow &= ~mask;
+  return mask;
+}
+
+uint16_t ButtonBank::add(DebounceButton &button) {
+  uint16_t mask = add(button._pin, (button._state & _BV(BUTTON_STATE_DOWN_BIT)) ? INPUT : INPUT_PULLUP,
+                      (button._state & _BV(BUTTON_STATE_DOWN_BIT)) ? HIGH : LOW);
+  if (mask) {
+    DebounceButton::bank = this;
+    button._bankMask = mask; // the button reads its bit of the bank
+    button._state |= _BV(BUTTON_STATE_BANK_BIT) | _BV(BUTTON_STATE_AFTER_DEBOUNCE_BIT);
+  }
+  return mask;
+}
+
+uint16_t ButtonBank::add(EventButton &button, ButtonHandler handler) {
+  for (uint8_t i = 0; i < _buttonCount; i++) {
+    if (_buttons[i] == &button) return button._bankMask; // already added
+  }
+  if (_buttonCount >= BUTTON_BANK_BUTTONS) return 0;
+  uint16_t mask = add((DebounceButton &)button);
+  if (mask) {
+    button._bankIndex = _buttonCount; // index of the button in the events
+    _buttons[_buttonCount] = &button;
+    _handlers[_buttonCount++] = handler;
+  }
+  return mask;
+}
+
+void ButtonBank::begin() {
+  uint8_t sreg = SREG;
+  cli();
+  _state = sample();
+  _count0 = _count1 = 0xFFFF;
+  _press = _release = 0;
+  _tick = millis();
+  SREG = sreg;
+}
+
+uint16_t ButtonBank::sample() {
+  uint16_t level = VPORTA.IN | ((uint16_t)VPORTB.IN << 8); // both ports in two reads
+  return (level ^ _activeLow) & _mask;                    // 1 - down
+}
+
+void ButtonBank::tick() {
+  uint16_t state = _state;
+  uint16_t changed = state ^ sample();
+
+  // 2-bit vertical counters: reset where the sample equals the state, count down where it differs
+  _count0 = ~(_count0 & changed);
+  _count1 = _count0 ^ (_count1 & changed);
+  changed &= _count0 & _count1; // counted to the end - 4 samples in the new state
+
+  state ^= changed;
+  _state = state;
+  _press |= changed & state;
+  _release |= changed & ~state;
+}
+
+bool ButtonBank::update() {
+  if (_timer) return false; // ticked in the interrupt
+  uint8_t now = millis();
+  if ((uint8_t)(now - _tick) < BUTTON_BANK_TICK) return false;
+  _tick = now;
+  tick();
+  return true;
+}
+
+uint16_t ButtonBank::pressed() {
+  uint8_t sreg = SREG; // 16 bits in two loads - a tick between them would mix two states
+  cli();
+  uint16_t state = _state;
+  SREG = sreg;
+  return state;
+}
+
+uint16_t ButtonBank::onPress(uint16_t mask) {
+  uint8_t sreg = SREG; // the interrupt sets the bits between the read and the write
+  cli();
+  uint16_t events = _press & mask;
+  _press &= ~events;
+  SREG = sreg;
+  return events;
+}
+
+uint16_t ButtonBank::onRelease(uint16_t mask) {
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t events = _release & mask;
+  _release &= ~events;
+  SREG = sreg;
+  return events;
+}
+
+void ButtonBank::timerTick() {
+  tick();
+  for (uint8_t i = 0; i < _buttonCount; i++) _handlers[i](_buttons[i], BUTTON_BANK_SAMPLE);
+}
+
+void ButtonBank::push(uint8_t index, uint8_t type) {
+  uint8_t head = _head;
+  if ((uint8_t)(head - _tail) >= BUTTON_BANK_EVENTS) { // full - the newest event is dropped
+    if (_lost < 0xFF) _lost++;
+    return;
+  }
+  ButtonEvent &event = _events[head & (BUTTON_BANK_EVENTS - 1)];
+  event.button = index;
+  event.type = type;
+  event.time = millis();
+  _head = head + 1;
+}
+
+bool ButtonBank::read(ButtonEvent &event) {
+  uint8_t tail = _tail;
+  while (tail != _head) {
+    event = _events[tail & (BUTTON_BANK_EVENTS - 1)]; // the slot is not written before _tail is moved
+    _tail = ++tail;
+    if (event.type != BUTTON_BANK_NO_EVENT) return true;
+  }
+  return false;
+}
+
+void ButtonBank::deliver(const ButtonEvent &event) {
+  EventButton *target = button(event.button);
+  if (target && (event.type < 8)) target->_realState |= _BV(event.type);
+}
+
+void ButtonBank::dispatch() {
+  ButtonEvent event;
+  while (read(event)) deliver(event);
+}
+
+void ButtonBank::reset(uint16_t mask) {
+  for (uint8_t i = 0; i < _buttonCount; i++) {
+    if (_buttons[i]->_bankMask & mask) _handlers[i](_buttons[i], BUTTON_BANK_RESET);
+  }
+}
+
+void ButtonBank::discard(uint8_t index) {
+  uint8_t sreg = SREG;
+  cli();
+  for (uint8_t i = _tail; i != _head; i++) {
+    ButtonEvent &event = _events[i & (BUTTON_BANK_EVENTS - 1)];
+    if (event.button == index) event.type = BUTTON_BANK_NO_EVENT;
+  }
+  SREG = sreg;
+}
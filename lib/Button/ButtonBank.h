@@ -0,0 +1,166 @@
+/*
+ * ButtonBank
+ *
+ * Debouncing of all buttons on VPORTA and VPORTB in one pass.
+ *
+ * file   : ButtonBank.h
+ *
+ *   Every tick both ports are read once and all pins are debounced in parallel by
+ *   2-bit vertical counters: bit n of _count0/_count1 is the counter of the pin n,
+ *   so one 16-bit operation updates all pins. A pin changes its state after
+ *   4 equal samples that differ from the state (4 ticks = 20 ms).
+ *
+ *   Bit of a pin: PAn - bit n, PBn - bit 8 + n.
+ *
+ *   The RealButton added to the bank reads its state from the bank - no digitalRead()
+ *   and no debounce timer per button. Its event API (onPress, onClick, onLong...) is unchanged.
+ *
+ *   Usage:
+ *          ButtonBank buttons;
+ *          RealButton btnStop(PIN_PA7);
+ *
+ *          buttons.add(btnStop);        // in setup()
+ *          buttons.begin();
+ *
+ *          buttons.update();            // in loop(), before the updates of the buttons
+ *          btnStop.update();
+ *
+ *   Timer mode (ButtonBankTimer.cpp): the bank is ticked in the TCB0 interrupt, where the
+ *   RealButtons are also updated. Their events (press, click, long...) are written to a ring
+ *   with the time of the event and delivered in order to the event API in loop() -
+ *   no event is lost while loop() is blocked (max. BUTTON_BANK_EVENTS are kept).
+ *
+ *          buttons.add(btnStop);        // in setup()
+ *          buttons.beginTimer();
+ *
+ *          buttons.dispatch();          // in loop(), instead of the updates
+ *          if (btnStop.onClick()) ...
+ */
+
+#ifndef BUTTON_BANK_H
+#define BUTTON_BANK_H
+
+#include "Arduino.h"
+
+#define BUTTON_BANK_TICK 5u   // sampling period in ms (debounce time = 4 ticks)
+#define BUTTON_BANK_EVENTS 16 // length of the event ring (power of 2)
+#define BUTTON_BANK_BUTTONS 8 // max. number of buttons with events (RealButton, PolicyButton) in the bank
+
+#define BUTTON_BANK_NO_EVENT 0xFF // type of a discarded event
+
+#define BUTTON_BANK_PA(n) ((uint16_t)_BV(n))        // bit of the pin PAn in the bank
+#define BUTTON_BANK_PB(n) ((uint16_t)_BV(n) << 8)   // bit of the pin PBn in the bank
+
+class DebounceButton;
+class EventButton;
+
+// operations of the ButtonHandler
+#define BUTTON_BANK_SAMPLE 0 // update of the button in the timer interrupt
+#define BUTTON_BANK_RESET  1 // reset of the button (ButtonBank::reset())
+
+/// @brief Sample / reset of a button of the bank (static function of RealButton, PolicyButton...)
+typedef void (*ButtonHandler)(EventButton *button, uint8_t operation);
+
+/// @brief Event of a RealButton updated in the timer interrupt
+struct ButtonEvent {
+  uint8_t button;   // index of the button in the bank
+  uint8_t type;     // BUTTON_EVENT_PRESS, BUTTON_EVENT_CLICK... (Button.h)
+  uint16_t time;    // millis() of the event (low word)
+};
+
+class ButtonBank {
+  public:
+    /// @brief Adds the pin to the bank
+    /// @param pin Pin number (PORTA or PORTB)
+    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
+    /// @param down Button "down" state: LOW (default) | HIGH
+    /// @return bit mask of the pin in the bank, 0 - the pin is not on PORTA / PORTB
+    uint16_t add(uint8_t pin, uint8_t mode = INPUT_PULLUP, bool down = LOW);
+
+    /// @brief Adds the button (its pin, mode and "down" state) - the button then reads its state from the bank
+    /// @return bit mask of the button in the bank, 0 - the pin is not on PORTA / PORTB
+    uint16_t add(DebounceButton &button);
+
+    /// @brief Adds the button with the event API (RealButton, PolicyButton) - in the timer mode its events are queued in the bank
+    /// @return bit mask of the button in the bank, 0 - the pin is not on PORTA / PORTB or too many buttons
+    template <class EventButtonType>
+    uint16_t add(EventButtonType &button) { return add(button, EventButtonType::handler); }
+
+    /// @brief Adds the button with the event API and its handler
+    uint16_t add(EventButton &button, ButtonHandler handler);
+
+    /// @brief Takes the current state of the pins as debounced (no events are generated)
+    void begin();
+
+    /// @brief Starts the timer mode: tick and update of the buttons in the TCB0 interrupt (ButtonBankTimer.cpp)
+    void beginTimer();
+
+    /// @brief Samples the ports every BUTTON_BANK_TICK ms (nothing in the timer mode)
+    /// @return true - a tick was done
+    bool update();
+
+    /// @brief One sample of both ports and debouncing of all pins (can be called from a timer interrupt)
+    void tick();
+
+    /// @brief Debounced state, bit 1 - the button is down (read atomically - written in the timer interrupt)
+    uint16_t pressed();
+
+    /// @brief Buttons pressed since the last call (the returned bits are cleared)
+    /// @param mask Buttons to test
+    uint16_t onPress(uint16_t mask = 0xFFFF);
+
+    /// @brief Buttons released since the last call (the returned bits are cleared)
+    /// @param mask Buttons to test
+    uint16_t onRelease(uint16_t mask = 0xFFFF);
+
+    /// @brief Takes the oldest event from the ring
+    /// @return false - no event
+    bool read(ButtonEvent &event);
+
+    /// @brief Sets the event to its button - onPress(), onClick()... of the button then return true
+    void deliver(const ButtonEvent &event);
+
+    /// @brief Delivers all queued events
+    void dispatch();
+
+    /// @brief Button of the event
+    EventButton *button(uint8_t index) { return (index < _buttonCount) ? _buttons[index] : NULL; }
+
+    /// @brief Resets the RealButtons of the mask - their events are discarded
+    void reset(uint16_t mask);
+
+    /// @brief Discards the queued events of the button (RealButton::reset())
+    void discard(uint8_t index);
+
+    /// @brief Events lost on a full ring
+    uint8_t lost() { return _lost; }
+
+    /// @brief Queues the event of the button (from the timer interrupt)
+    void push(uint8_t index, uint8_t type);
+
+    /// @brief Update of the bank and of the buttons in the timer interrupt
+    void timerTick();
+
+  private:
+    uint16_t _mask = 0;       // pins of the bank
+    uint16_t _activeLow = 0;  // pins with the "down" state LOW
+    volatile uint16_t _state = 0;   // debounced state, 1 - down (written in the interrupt)
+    uint16_t _count0 = 0xFFFF;      // vertical counter, bit 0
+    uint16_t _count1 = 0xFFFF;      // vertical counter, bit 1
+    volatile uint16_t _press = 0;   // press events
+    volatile uint16_t _release = 0; // release events
+    uint8_t _tick = 0;        // time of the last tick (ms, low byte)
+    bool _timer = false;      // updated in the timer interrupt
+
+    EventButton *_buttons[BUTTON_BANK_BUTTONS]; // buttons with the event API
+    ButtonHandler _handlers[BUTTON_BANK_BUTTONS]; // their sample / reset
+    uint8_t _buttonCount = 0;
+    ButtonEvent _events[BUTTON_BANK_EVENTS];  // event ring
+    volatile uint8_t _head = 0;               // written in the interrupt
+    volatile uint8_t _tail = 0;               // read in loop()
+    volatile uint8_t _lost = 0;
+
+    uint16_t sample();
+};
+
+#endif
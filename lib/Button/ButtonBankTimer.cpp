@@ -0,0 +1,46 @@
+/*
+ * ButtonBank
+ *
+ * Timer mode of the ButtonBank - periodic interrupt of TCB0.
+ *
+ * file   : ButtonBankTimer.cpp
+ *
+ *   TCB0 runs in the periodic interrupt mode with the period BUTTON_BANK_TICK ms.
+ *   In the interrupt the bank samples the ports and updates its RealButtons,
+ *   their events are queued in the ring of the bank.
+ *   (millis() of megaTinyCore must not use TCB0 - the default on the 2-series is TCB1.)
+ */
+
+#include "ButtonBank.h"
+#include "Button.h"
+
+#if defined(TCB0)
+
+#if defined(MILLIS_USE_TIMERB0)
+#error "ButtonBank timer mode needs TCB0 - select another millis() timer"
+#endif
+
+static ButtonBank *timerBank = nullptr;
+
+void ButtonBank::beginTimer() {
+  TCB0.CTRLA = 0; // stopped while the bank is initialized (beginTimer() can be called again)
+  begin();
+  for (uint8_t i = 0; i < _buttonCount; i++) _buttons[i]->_state |= _BV(BUTTON_STATE_TIMER_BIT);
+  _head = _tail = 0;
+  _timer = true;
+  timerBank = this;
+
+  TCB0.CTRLB = TCB_CNTMODE_INT_gc;                             // periodic interrupt
+  TCB0.CCMP = (uint16_t)((F_CPU / 2000UL) * BUTTON_BANK_TICK - 1); // CLK_PER / 2
+  TCB0.CNT = 0;
+  TCB0.INTFLAGS = TCB_CAPT_bm;
+  TCB0.INTCTRL = TCB_CAPT_bm;
+  TCB0.CTRLA = TCB_CLKSEL_DIV2_gc | TCB_ENABLE_bm;
+}
+
+ISR(TCB0_INT_vect) {
+  TCB0.INTFLAGS = TCB_CAPT_bm;
+  if (timerBank) timerBank->timerTick();
+}
+
+#endif
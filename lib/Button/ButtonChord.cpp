@@ -0,0 +1,99 @@
+/*
+ * ButtonChords
+ *
+ * Chords and combos of the buttons of a ButtonBank, declared in a table in flash.
+ *
+ * file   : ButtonChord.cpp
+ */
+
+#include "ButtonChord.h"
+
+void ButtonChords::begin(ButtonBank &bank, const ButtonChord *table, uint8_t count) {
+  _bank = &bank;
+  _table = table;
+  _count = (count < BUTTON_CHORD_MAX) ? count : BUTTON_CHORD_MAX;
+  _mask = 0;
+  _held = _fired = _started = _repeated = 0;
+  uint16_t pressed = bank.pressed();
+  for (uint8_t i = 0; i < _count; i++) {
+    ButtonChord item;
+    chord(i, item);
+    _mask |= item.buttons;
+    if ((pressed & item.buttons) == item.buttons) { // held over begin() - fires again only after a release
+      _held |= _BV(i);
+      _fired |= _BV(i);
+      _since[i] = millis();
+    }
+  }
+  _latched = pressed & _mask; // not a chord - released without events
+}
+
+void ButtonChords::chord(uint8_t index, ButtonChord &chord) {
+  memcpy_P(&chord, &_table[index], sizeof(ButtonChord));
+}
+
+bool ButtonChords::update(bool locked) {
+  if (!_bank) return false;
+
+  uint16_t now = millis();
+  uint16_t pressed = _bank->pressed() & _mask;
+
+  // released buttons of the chord in progress - their single-button events are discarded
+  uint16_t released = _latched & ~pressed;
+  if (released) {
+    _bank->reset(released);
+    _latched &= ~released;
+  }
+
+  // held chords, the chord with the highest priority
+  int8_t best = -1;
+  uint8_t best_priority = 0;
+  ButtonChord item;
+  for (uint8_t i = 0; i < _count; i++) {
+    uint8_t bit = _BV(i);
+    chord(i, item);
+    if ((pressed & item.buttons) != item.buttons) {
+      _held &= ~bit;
+      _fired &= ~bit;
+      _started &= ~bit;
+      _repeated &= ~bit;
+      continue;
+    }
+    if (!(_held & bit)) {
+      _held |= bit;
+      _since[i] = now;
+    }
+    if (item.buttons & (item.buttons - 1)) _latched |= item.buttons; // two or more buttons
+
+    if ((best < 0) || (item.priority > best_priority)) {
+      best = i;
+      best_priority = item.priority;
+    }
+  }
+  if ((best < 0) || (_fired & _BV(best))) return _latched;
+
+  // is the action due?
+  uint8_t bit = _BV(best);
+  chord(best, item);
+  uint16_t wait = item.hold;
+  if (_started & bit) wait = (_repeated & bit) ? item.repeatTime : item.repeatDelay;
+  if ((uint16_t)(now - _since[best]) < wait) return _latched;
+
+  bool repeat = _started & bit;
+  if (repeat) _repeated |= bit;
+  _started |= bit;
+  _since[best] = now;
+  if (!item.repeatDelay) _fired |= bit; // once in the hold
+  _latched |= item.buttons;
+
+  // the other held chords with a common button are consumed
+  for (uint8_t i = 0; i < _count; i++) {
+    if ((i == best) || !(_held & _BV(i))) continue;
+    ButtonChord other;
+    chord(i, other);
+    if (other.buttons & item.buttons) _fired |= _BV(i);
+  }
+
+  if (!locked || (item.flags & BUTTON_CHORD_ALWAYS)) item.action(repeat);
+  return true;
+}
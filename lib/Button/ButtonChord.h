@@ -0,0 +1,93 @@
+/*
+ * ButtonChords
+ *
+ * Chords and combos of the buttons of a ButtonBank, declared in a table in flash.
+ *
+ * file   : ButtonChord.h
+ *
+ *   A chord is a set of buttons (bank mask) held together for the hold time. Its action is
+ *   called once, or repeated while held (repeatDelay, repeatTime). A chord of one button is
+ *   a long press with its own action.
+ *
+ *   The chord is held when all its buttons are down (other buttons can be down too).
+ *   Of the held chords only the chord with the highest priority can fire. A fired chord
+ *   consumes the other held chords with a common button (e.g. M-long after M + <).
+ *
+ *   The buttons of a chord of two or more buttons (and of any fired chord) are latched:
+ *   when they are released, their RealButtons are reset, so their click, long, double...
+ *   events are not used. While a button is latched, active() is true.
+ *
+ *   update() does not wait - long combos do not stall loop().
+ *
+ *   Usage:
+ *          void resetChord(bool repeat);
+ *
+ *          const ButtonChord chord_table[] PROGMEM = {
+ *            // buttons                            hold   delay period priority flags                action
+ *            {BUTTON_BANK_PA(6) | BUTTON_BANK_PA(7), 10000, 0,    0,     1,       BUTTON_CHORD_ALWAYS, resetChord},
+ *          };
+ *          ButtonChords chords;
+ *
+ *          chords.begin(buttons, chord_table, sizeof(chord_table) / sizeof(chord_table[0])); // in setup()
+ *
+ *          if (chords.update()) ...     // in loop(), before the events of the buttons are used
+ */
+
+#ifndef BUTTON_CHORD_H
+#define BUTTON_CHORD_H
+
+#include "Arduino.h"
+#include "ButtonBank.h"
+
+#define BUTTON_CHORD_MAX 8 // max. number of chords in the table
+
+// flags of the chord
+#define BUTTON_CHORD_ALWAYS 0x01 // fired also when the actions are locked (update(true))
+
+/// @brief Action of the chord
+/// @param repeat false - first call in the hold, true - auto-repeat
+typedef void (*ButtonChordAction)(bool repeat);
+
+/// @brief Chord in the table (PROGMEM)
+struct ButtonChord {
+  uint16_t buttons;     // bank mask of the buttons
+  uint16_t hold;        // hold time before the action (ms)
+  uint16_t repeatDelay; // time from the action to the first repeat, 0 - no repeat (ms)
+  uint16_t repeatTime;  // period of the repeats (ms)
+  uint8_t priority;     // higher wins
+  uint8_t flags;        // BUTTON_CHORD_*
+  ButtonChordAction action;
+};
+
+class ButtonChords {
+  public:
+    /// @brief Sets the table of the chords. The buttons down now are latched until released.
+    /// @param bank Bank of the buttons
+    /// @param table Chords in flash (PROGMEM)
+    /// @param count Number of the chords (max. BUTTON_CHORD_MAX)
+    void begin(ButtonBank &bank, const ButtonChord *table, uint8_t count);
+
+    /// @brief Evaluates the chords and calls the action of the chord being due
+    /// @param locked true - only the chords with BUTTON_CHORD_ALWAYS are fired (the others are consumed)
+    /// @return true - a chord is in progress, the single-button events must not be used
+    bool update(bool locked = false);
+
+    /// @brief A chord is in progress (its buttons are not released yet)
+    bool active() { return _latched; }
+
+  private:
+    ButtonBank *_bank = NULL;
+    const ButtonChord *_table = NULL;
+    uint8_t _count = 0;
+    uint16_t _mask = 0;       // buttons of all the chords
+    uint16_t _latched = 0;    // buttons of the chord in progress
+    uint8_t _held = 0;        // chords held
+    uint8_t _fired = 0;       // chords done in this hold
+    uint8_t _started = 0;     // chords fired at least once in this hold (repeating)
+    uint8_t _repeated = 0;    // chords repeated at least once in this hold
+    uint16_t _since[BUTTON_CHORD_MAX]; // start of the hold / time of the last action
+
+    void chord(uint8_t index, ButtonChord &chord);
+};
+
+#endif
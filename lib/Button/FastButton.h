@@ -0,0 +1,46 @@
+/*
+ * FastButton
+ *
+ * RealButton with the pin known at compile time.
+ *
+ * file   : FastButton.h
+ *
+ *   RealButton::update() reads the pin by digitalRead(_pin) - the port and the bit mask
+ *   are looked up in the tables of the core on every call. FastButton<PIN>::update()
+ *   reads it by digitalReadFast(PIN), which the core resolves at compile time to one
+ *   sbis / sbic on the VPORT register. The events (onPress, onClick...) are the same.
+ *
+ *   A button added to a ButtonBank is read by the bank (VPORTA / VPORTB at once),
+ *   FastButton then behaves as RealButton. RealButton stays for pins known at run time.
+ *
+ *   Usage:
+ *          FastButton<PIN_PB0> btnPrev;
+ *
+ *          btnPrev.update();            // in loop()
+ *          if (btnPrev.onClick()) ...
+ */
+
+#ifndef FAST_BUTTON_H
+#define FAST_BUTTON_H
+
+#include "Button.h"
+
+template <uint8_t PIN>
+class FastButton : public RealButton {
+  public:
+    /// @brief Constructor + initialization
+    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
+    /// @param down Button "down" on state: LOW (default) | HIGH
+    /// @param debouncetime time in ms (20ms default)
+    FastButton(uint8_t mode = INPUT_PULLUP, bool down = LOW, uint16_t debouncetime = BUTTON_DEBOUNCE_TIME)
+      : RealButton(PIN, mode, down, debouncetime) {}
+
+    /// @brief Updates the state of the button (the pin is read by digitalReadFast())
+    bool update() {
+      if (banked()) return RealButton::update(); // read by the bank
+      debounce(digitalReadFast(PIN) == HIGH);
+      return events();
+    }
+};
+
+#endif
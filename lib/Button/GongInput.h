@@ -0,0 +1,182 @@
+/*
+ * GongInput
+ *
+ * Gong input for a DC voltage, an AC voltage (50/60 Hz pulses) or a button contact.
+ *
+ * file   : GongInput.h
+ *
+ *   A debounced button restarts its debounce time on every edge - the pulses of a rectified
+ *   AC voltage (one per mains period) delay it or make it chatter. GongInput measures the
+ *   pulses in the pin change interrupt (both edges, time in us) and keeps an envelope:
+ *
+ *     - a pulse of the active level at least GONG_INPUT_MIN_PULSE us long starts the ring:
+ *       at its end (AC pulse) or at the next tick while it lasts (DC level, contact) -
+ *       within one half-period of the mains
+ *     - a shorter pulse (EMI spike on long wires, contact bounce) is ignored
+ *     - the ring ends GONG_INPUT_RELEASE_TIME ms after the last pulse (longer than the
+ *       gap between the AC pulses)
+ *
+ *   onPress - start of the ring, onRelease - end of the ring, pressed() - ring in progress.
+ *   At the end of the ring the signal is classified (signal()): AC - a train of pulses,
+ *   CONTACT - one level with bounces at the start, DC - one clean level.
+ *   latency() - time from the start of the pulse to the detection (us).
+ *
+ *   The ticks come from the timer interrupt of a ButtonBank (add() + beginTimer()) or from update().
+ *
+ *   Usage:
+ *          GongInput<PIN_PA3> btnGong;
+ *
+ *          buttons.add(btnGong);        // in setup()
+ *          btnGong.begin();
+ *
+ *          if (btnGong.onPress()) ...   // in loop()
+ */
+
+#ifndef GONG_INPUT_H
+#define GONG_INPUT_H
+
+#include "Button.h"
+
+#define GONG_INPUT_MIN_PULSE    1000u // shortest valid pulse (us)
+#define GONG_INPUT_RELEASE_TIME 40u   // end of the ring after the last pulse (ms), > 1 mains period
+
+// signal of the last ring
+#define GONG_SIGNAL_NONE     0
+#define GONG_SIGNAL_DC       1 // one clean level
+#define GONG_SIGNAL_AC       2 // train of pulses (rectified AC)
+#define GONG_SIGNAL_CONTACT  3 // one level with bounces (button contact)
+
+template <uint8_t PIN>
+class GongInput : public EventButton {
+  public:
+    /// @brief Constructor
+    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
+    /// @param down Active level: LOW (default) | HIGH
+    GongInput(uint8_t mode = INPUT_PULLUP, bool down = LOW) : EventButton(PIN, mode, down, 0) {
+      _activeLevel = down;
+    }
+
+    /// @brief Starts the pin change interrupt
+    void begin() {
+      uint8_t sreg = SREG;
+      cli();
+      _instance = this;
+      _active = false;
+      _on = false;
+      _pulses = _spikes = 0;
+      _lastActive = millis();
+      edge(); // the current level
+      SREG = sreg;
+      attachInterrupt(digitalPinToInterrupt(PIN), edge, CHANGE);
+    }
+
+    /// @brief Envelope tick (nothing in the timer mode of the bank - ticked in the interrupt)
+    bool update() {
+      if (timed()) return false;
+      uint8_t sreg = SREG;
+      cli();
+      tick();
+      SREG = sreg;
+      return false;
+    }
+
+    /// @brief Resets the events
+    bool reset() {
+      uint8_t sreg = SREG;
+      cli();
+      clearEvents();
+      SREG = sreg;
+      return false;
+    }
+
+    /// @brief Signal of the last ring: GONG_SIGNAL_*
+    uint8_t signal() { return _signal; }
+
+    /// @brief Time from the start of the pulse to the detection of the last ring (us)
+    uint16_t latency() { return _latency; }
+
+    /// @brief Pulses of the last ring (AC: about one per mains period)
+    uint8_t pulses() { return _lastPulses; }
+
+  private:
+    friend class ButtonBank;
+
+    static GongInput *_instance;
+
+    bool _activeLevel;
+    volatile bool _active = false;   // the input is at the active level
+    volatile bool _on = false;       // ring in progress (envelope)
+    volatile uint16_t _since;        // start of the active level (us)
+    volatile uint16_t _lastActive;   // last time at the active level (ms)
+    volatile uint8_t _pulses = 0;    // valid pulses in the ring
+    volatile uint8_t _spikes = 0;    // rejected pulses in the ring
+    uint8_t _lastPulses = 0;
+    uint8_t _signal = GONG_SIGNAL_NONE;
+    uint16_t _latency = 0;
+
+    /// @brief Pin change interrupt
+    static void edge() {
+      GongInput *self = _instance;
+      if (!self) return;
+      uint16_t now = micros();
+      if ((digitalReadFast(PIN) == HIGH) == self->_activeLevel) {
+        if (!self->_active) {
+          self->_active = true;
+          self->_since = now;
+        }
+      }
+      else if (self->_active) {
+        self->_active = false;
+        if ((uint16_t)(now - self->_since) >= GONG_INPUT_MIN_PULSE) {
+          if (self->_pulses < 0xFF) self->_pulses++;
+          self->_lastActive = millis();
+          if (!self->_on) self->fire(now);
+        }
+        else {
+          if (self->_spikes < 0xFF) self->_spikes++; // EMI spike, contact bounce
+          if (!self->_on) self->_lastActive = millis();
+        }
+      }
+    }
+
+    /// @brief Start of the ring
+    void fire(uint16_t now) {
+      _on = true;
+      _latency = now - _since;
+      _state |= _BV(BUTTON_STATE_PRESSED_BIT);
+      event(BUTTON_EVENT_PRESS);
+    }
+
+    /// @brief Level lasting since the last edge, end of the ring (interrupts disabled)
+    void tick() {
+      uint16_t now = millis();
+      if (_active) {
+        _lastActive = now;
+        if (!_on && ((uint16_t)((uint16_t)micros() - _since) >= GONG_INPUT_MIN_PULSE)) fire(micros());
+      }
+      else if (_on && ((uint16_t)(now - _lastActive) > GONG_INPUT_RELEASE_TIME)) {
+        _on = false;
+        _lastPulses = _pulses;
+        if (_pulses >= 2) _signal = GONG_SIGNAL_AC;
+        else if (_spikes) _signal = GONG_SIGNAL_CONTACT;
+        else _signal = GONG_SIGNAL_DC;
+        _pulses = _spikes = 0;
+        _state &= ~_BV(BUTTON_STATE_PRESSED_BIT);
+        event(BUTTON_EVENT_RELEASE);
+      }
+      else if (!_on && ((uint16_t)(now - _lastActive) > GONG_INPUT_RELEASE_TIME)) {
+        _spikes = 0; // spikes between the rings
+      }
+    }
+
+    static void handler(EventButton *button, uint8_t operation) {
+      GongInput *self = static_cast<GongInput *>(button);
+      if (operation == BUTTON_BANK_RESET) self->clearEvents();
+      else self->tick();
+    }
+};
+
+template <uint8_t PIN>
+GongInput<PIN> *GongInput<PIN>::_instance = nullptr;
+
+#endif
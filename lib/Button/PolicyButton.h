@@ -0,0 +1,236 @@
+/*
+ * PolicyButton
+ *
+ * Button with the timings and the detectors chosen at compile time.
+ *
+ * file   : PolicyButton.h
+ *
+ *   RealButton keeps longTime, veryLongTime, dblPressTime, dblReleaseTime, the long and
+ *   the double-click timers and the double-click automaton in RAM of every instance and
+ *   runs all the detectors on every update. PolicyButton<Policy> takes the timings as
+ *   constants of the policy and compiles in only the detectors of Policy::features -
+ *   the timers of a detector that is not used take no RAM and no time.
+ *
+ *   Policy:
+ *          struct MyPolicy : ButtonPolicy {                   // defaults of RealButton
+ *            static const uint8_t features = BUTTON_DETECT_CLICK | BUTTON_DETECT_LONG;
+ *            static const uint16_t longTime = 2000;
+ *          };
+ *
+ *   Events of the detectors (the other events of EventButton are never set):
+ *          always               - onPress, onRelease
+ *          BUTTON_DETECT_CLICK  - onClick, onLongClick, onVLongClick
+ *          BUTTON_DETECT_LONG   - onLong
+ *          BUTTON_DETECT_VLONG  - onVLong
+ *          BUTTON_DETECT_DOUBLE - onDouble
+ *
+ *   RAM of an instance (AVR): EventButton 12 B, + 3 B (click / long / vlong), + 3 B (double).
+ *   RealButton: 26 B. The cycles of update() are printed by printButtonCosts() (main.cpp).
+ *
+ *   The button can be added to a ButtonBank like RealButton.
+ *
+ *   Usage:
+ *          PolicyButton<ButtonPressPolicy> btnGong(PIN_PA3);
+ *
+ *          btnGong.update();            // in loop()
+ *          if (btnGong.onPress()) ...
+ *
+ *   Needs C++17 (if constexpr) - megaTinyCore compiles with -std=gnu++17.
+ */
+
+#ifndef POLICY_BUTTON_H
+#define POLICY_BUTTON_H
+
+#include "Button.h"
+
+// detectors of the policy (Policy::features)
+#define BUTTON_DETECT_CLICK   0x01 // onClick, onLongClick, onVLongClick
+#define BUTTON_DETECT_LONG    0x02 // onLong
+#define BUTTON_DETECT_VLONG   0x04 // onVLong
+#define BUTTON_DETECT_DOUBLE  0x08 // onDouble
+#define BUTTON_DETECT_ALL     0x0F
+#define BUTTON_DETECT_TIMER   (BUTTON_DETECT_CLICK | BUTTON_DETECT_LONG | BUTTON_DETECT_VLONG) // need the long timer
+
+// bits of _timerState
+#define BUTTON_POLICY_LONG_BP     0 // long timer is running
+#define BUTTON_POLICY_ON_LONG_BP  2 // ON_LONG was generated in this press
+#define BUTTON_POLICY_ON_VLONG_BP 3 // ON_VLONG was generated in this press
+
+/// @brief Default policy - all the detectors, the timings of RealButton
+struct ButtonPolicy {
+  static const uint8_t features = BUTTON_DETECT_ALL;
+  static const uint16_t longTime = BUTTON_LONG_TIME;
+  static const uint16_t veryLongTime = BUTTON_VLONG_TIME;
+  static const uint16_t dblPressTime = BUTTON_TIMER_MAX_DOUBLE_PRESS_TIME;
+  static const uint16_t dblReleaseTime = BUTTON_TIMER_MAX_DOUBLE_RELEASE_TIME;
+};
+
+/// @brief onPress / onRelease only (gong input)
+struct ButtonPressPolicy : ButtonPolicy {
+  static const uint8_t features = 0;
+};
+
+/// @brief onClick and onLong (the buttons of the panel)
+struct ButtonClickPolicy : ButtonPolicy {
+  static const uint8_t features = BUTTON_DETECT_CLICK | BUTTON_DETECT_LONG;
+};
+
+/// @brief Long timer - only in the buttons with the click / long / vlong detectors
+template <bool ENABLED> struct ButtonLongTimer {
+  uint16_t _longTimer;   // start of the press
+  uint8_t _timerState;   // BUTTON_POLICY_*_BP
+};
+template <> struct ButtonLongTimer<false> {};
+
+/// @brief Double-click timer and automaton - only in the buttons with the double detector
+template <bool ENABLED> struct ButtonDoubleTimer {
+  uint16_t _dblTimer;
+  uint8_t _dblState;     // state of the automaton
+};
+template <> struct ButtonDoubleTimer<false> {};
+
+template <class Policy>
+class PolicyButton : public EventButton,
+                     private ButtonLongTimer<(Policy::features & BUTTON_DETECT_TIMER) != 0>,
+                     private ButtonDoubleTimer<(Policy::features & BUTTON_DETECT_DOUBLE) != 0> {
+  public:
+    static const bool hasTimer = (Policy::features & BUTTON_DETECT_TIMER) != 0;
+    static const bool hasDouble = (Policy::features & BUTTON_DETECT_DOUBLE) != 0;
+
+    /// @brief Constructor + initialization
+    /// @param pin Pin number
+    /// @param mode Pin mode INPUT | INPUT_PULLUP (default)
+    /// @param down Button "down" on state: LOW (default) | HIGH
+    /// @param debouncetime time in ms (20ms default)
+    PolicyButton(uint8_t pin, uint8_t mode = INPUT_PULLUP, bool down = LOW, uint16_t debouncetime = BUTTON_DEBOUNCE_TIME)
+      : EventButton(pin, mode, down, debouncetime) {
+      clearTimers();
+      DebounceButton::start();
+    }
+
+    /// @brief Initializes the button
+    /// @param down true - the button is down
+    void start(bool down = false) {
+      reset();
+      update();
+      _oldPressed = down;
+    }
+
+    /// @brief Updates the state of the button (nothing in the timer mode of the bank)
+    bool update() {
+      if (timed()) return false; // updated in the timer interrupt
+      return sample();
+    }
+
+    /// @brief Resets the events and the timers
+    bool reset() {
+      uint8_t sreg = SREG; // the timers are updated in the timer interrupt
+      cli();
+      clearTimers();
+      clearEvents();
+      SREG = sreg;
+      update();
+      return false;
+    }
+
+  private:
+    friend class ButtonBank;
+
+    void clearTimers() {
+      if constexpr (hasTimer) {
+        this->_longTimer = 0;
+        this->_timerState = 0;
+      }
+      if constexpr (hasDouble) {
+        this->_dblTimer = 0;
+        this->_dblState = 0;
+      }
+    }
+
+    bool sample() {
+      DebounceButton::update();
+      if (_oldPressed) {
+        if (pressed()) {
+          if constexpr ((Policy::features & (BUTTON_DETECT_LONG | BUTTON_DETECT_VLONG)) != 0) {
+            if (this->_timerState & _BV(BUTTON_POLICY_LONG_BP)) {
+              uint16_t time = uint16_t(millis()) - this->_longTimer;
+              if ((Policy::features & BUTTON_DETECT_LONG) && (time > Policy::longTime) && !(this->_timerState & _BV(BUTTON_POLICY_ON_LONG_BP))) {
+                this->_timerState |= _BV(BUTTON_POLICY_ON_LONG_BP); // once in the press
+                event(BUTTON_EVENT_LONG);
+              }
+              if ((Policy::features & BUTTON_DETECT_VLONG) && (time > Policy::veryLongTime) && !(this->_timerState & _BV(BUTTON_POLICY_ON_VLONG_BP))) {
+                this->_timerState |= _BV(BUTTON_POLICY_ON_VLONG_BP);
+                event(BUTTON_EVENT_VLONG);
+              }
+            }
+          }
+        }
+        else {
+          event(BUTTON_EVENT_RELEASE);
+          _state2 = 0x00; // onLong readed
+          if constexpr ((Policy::features & BUTTON_DETECT_CLICK) != 0) {
+            if (this->_timerState & _BV(BUTTON_POLICY_LONG_BP)) {
+              uint16_t time = uint16_t(millis()) - this->_longTimer;
+              if (time < Policy::longTime) event(BUTTON_EVENT_CLICK);
+              else if (time < Policy::veryLongTime) event(BUTTON_EVENT_LONGCLICK);
+              else event(BUTTON_EVENT_VLONGCLICK);
+            }
+          }
+          if constexpr (hasTimer) this->_timerState = 0;
+          _oldPressed = false;
+        }
+      }
+      else if (pressed()) {
+        event(BUTTON_EVENT_PRESS);
+        if constexpr (hasTimer) {
+          this->_timerState = _BV(BUTTON_POLICY_LONG_BP);
+          this->_longTimer = millis();
+        }
+        _oldPressed = true;
+      }
+      if constexpr (hasDouble) updateDouble();
+      return false;
+    }
+
+    void updateDouble() {
+      uint16_t time = uint16_t(millis()) - this->_dblTimer;
+      switch (this->_dblState) {
+        case 0:
+          if (pressed()) {
+            this->_dblTimer = millis();
+            this->_dblState = 1;
+          }
+          break;
+        case 1:
+          if (time > Policy::dblPressTime) this->_dblState = 0;
+          else if (!pressed() && (time > BUTTON_TIMER_MIN_DOUBLE_TIME)) {
+            this->_dblState = 2;
+            this->_dblTimer = millis();
+          }
+          break;
+        case 2:
+          if (time > Policy::dblReleaseTime) this->_dblState = 0;
+          else if (pressed() && (time > BUTTON_TIMER_MIN_DOUBLE_TIME)) {
+            this->_dblState = 3;
+            this->_dblTimer = millis();
+          }
+          break;
+        case 3:
+          if (time > Policy::dblPressTime) this->_dblState = 0;
+          else if (!pressed() && (time > BUTTON_TIMER_MIN_DOUBLE_TIME)) {
+            this->_dblState = 0;
+            this->_dblTimer = 0;
+            event(BUTTON_EVENT_DOUBLE);
+          }
+          break;
+      }
+    }
+
+    static void handler(EventButton *button, uint8_t operation) {
+      PolicyButton *self = static_cast<PolicyButton *>(button);
+      if (operation == BUTTON_BANK_RESET) self->reset();
+      else self->sample();
+    }
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * DFPlayerBusy
+ *
+ * BUSY output of the DFPlayer Mini on a pin known at compile time.
+ *
+ * file   : DFPlayerBusy.h
+ *
+ *   BUSY is LOW while the player plays. The pin is read by digitalReadFast(PIN),
+ *   which the core resolves at compile time to one sbis / sbic on the VPORT register
+ *   (digitalRead() looks up the port and the bit mask on every call).
+ *
+ *   Usage:
+ *          DFPlayerBusy<PIN_PA5> playerBusy;
+ *
+ *          playerBusy.begin();                // in setup()
+ *          if (playerBusy.busy()) ...         // playing
+ *          if (playerBusy.edge() > 0) ...     // started to play
+ */
+
+#ifndef DFPLAYER_BUSY_H
+#define DFPLAYER_BUSY_H
+
+#include "Arduino.h"
+
+template <uint8_t PIN>
+class DFPlayerBusy {
+  public:
+    /// @brief Sets the pin as input
+    void begin() {
+      pinMode(PIN, INPUT);
+    }
+
+    /// @brief State of BUSY
+    /// @return true - LOW (playing), false - HIGH
+    bool busy() {
+      return digitalReadFast(PIN) == LOW;
+    }
+
+    /// @brief Change of BUSY since the last call
+    /// @param reset false - the change is reported again by the next call
+    /// @return 1 - to LOW (playing), -1 - to HIGH, 0 - no change
+    int edge(bool reset = true) {
+      bool state = busy();
+      if (state == _previous) return 0;
+      if (reset) _previous = state;
+      return state ? 1 : -1;
+    }
+
+  private:
+    bool _previous = false;
+};
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * DFPlayerDriver
+ *
+ * DFPlayer Mini driver with the serial transport known at compile time.
+ *
+ * file   : DFPlayerDriver.h
+ *
+ *   DFRobotDFPlayerMini talks to a Stream - every available(), read() and write()
+ *   is a virtual call. DFPlayerDriver<Transport> calls the transport directly
+ *   (qualified, non-virtual calls), so the polling in available() is inlined.
+ *   The frames sent from the queue go through one plain function pointer.
+ *
+ *   Transport must provide:
+ *          int read();                                        // -1 if nothing was received
+ *          size_t write(const uint8_t *buffer, size_t size);
+ *
+ *   The default transport is DFPlayerUsart (USART1); DFPlayerHostTransport can be
+ *   used on the host for tests and benchmarks. begin(Stream&) is still available.
+ *
+ *   Usage:
+ *          DFPlayerDriver<> myDFPlayer;
+ *          DFPlayerUsart playerSerial;
+ *
+ *          playerSerial.begin(9600, myDFPlayer);
+ *          myDFPlayer.begin(playerSerial);
+ */
+
+#ifndef DFPLAYER_DRIVER_H
+#define DFPLAYER_DRIVER_H
+
+#include "DFRobotDFPlayerMini.h"
+
+#if defined(USART1)
+#include "DFPlayerUsart.h"
+#define DFPLAYER_DEFAULT_TRANSPORT DFPlayerUsart
+#endif
+
+#ifdef DFPLAYER_DEFAULT_TRANSPORT
+template <class Transport = DFPLAYER_DEFAULT_TRANSPORT>
+#else
+template <class Transport>
+#endif
+class DFPlayerDriver final : public DFRobotDFPlayerMini {
+  public:
+    using DFRobotDFPlayerMini::begin;
+
+    /// @brief Initializes the player on the transport
+    /// @param transport Serial transport (initialized)
+    /// @param isACK true - the player acknowledges every command
+    /// @param doReset true - the player is reset and the function waits for it
+    /// @return true if the player is online
+    bool begin(Transport &transport, bool isACK = true, bool doReset = true) {
+      _transport = &transport;
+      return DFRobotDFPlayerMini::begin(&transport, readByte, writeFrame, isACK, doReset);
+    }
+
+    /// @brief Receives the bytes, sends the queued commands and returns true if an event is ready
+    bool available() {
+      int data;
+      while ((data = _transport->Transport::read()) >= 0) { // bytes not received by the interrupt
+        receiveByte(data);
+      }
+      return update();
+    }
+
+  private:
+    Transport *_transport = nullptr;
+
+    static int readByte(void *port) {
+      return static_cast<Transport*>(port)->Transport::read();
+    }
+
+    static void writeFrame(void *port, const uint8_t *frame) {
+      static_cast<Transport*>(port)->Transport::write(frame, DFPLAYER_SEND_LENGTH);
+    }
+};
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * DFPlayerHostTransport
+ *
+ * In-memory serial transport of DFPlayerDriver for host tests and benchmarks.
+ *
+ * file   : DFPlayerHostTransport.h
+ *
+ *   The bytes of the player are put in by feed(), the bytes written by the driver
+ *   are collected in the transmit buffer or passed to the handler, which can
+ *   answer them (e.g. an emulated player).
+ *
+ *   Usage:
+ *          DFPlayerHostTransport transport;
+ *          DFPlayerDriver<DFPlayerHostTransport> player;
+ *
+ *          transport.handler = answer;     // void answer(DFPlayerHostTransport &, const uint8_t *, size_t)
+ *          player.begin(transport, true, false);
+ */
+
+#ifndef DFPLAYER_HOST_TRANSPORT_H
+#define DFPLAYER_HOST_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DFPLAYER_HOST_RX_LENGTH 256  // received bytes buffer (must be a power of 2)
+#define DFPLAYER_HOST_TX_LENGTH 256  // sent bytes buffer
+
+class DFPlayerHostTransport {
+  public:
+    /// @brief Called for every write of the driver (one frame); nullptr - bytes are stored in tx
+    void (*handler)(DFPlayerHostTransport &transport, const uint8_t *data, size_t length) = nullptr;
+
+    uint8_t tx[DFPLAYER_HOST_TX_LENGTH]; // sent bytes (if there is no handler)
+    size_t txLength = 0;
+
+    /// @brief Bytes from the player to the driver
+    /// @return count of stored bytes (the rest is lost - the buffer is full)
+    size_t feed(const uint8_t *data, size_t length) {
+      size_t i;
+      for (i = 0; i < length; i++) {
+        uint16_t next = (_rxHead + 1) & (DFPLAYER_HOST_RX_LENGTH - 1);
+        if (next == _rxTail) break;
+        _rx[_rxHead] = data[i];
+        _rxHead = next;
+      }
+      return i;
+    }
+
+    /// @brief Removes all received and sent bytes
+    void clear() {
+      _rxHead = _rxTail = 0;
+      txLength = 0;
+    }
+
+    int available() {
+      return (_rxHead - _rxTail) & (DFPLAYER_HOST_RX_LENGTH - 1);
+    }
+
+    int read() {
+      if (_rxHead == _rxTail) return -1;
+      uint8_t data = _rx[_rxTail];
+      _rxTail = (_rxTail + 1) & (DFPLAYER_HOST_RX_LENGTH - 1);
+      return data;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+      if (handler) {
+        handler(*this, buffer, size);
+        return size;
+      }
+      if (size > DFPLAYER_HOST_TX_LENGTH - txLength) size = DFPLAYER_HOST_TX_LENGTH - txLength;
+      memcpy(tx + txLength, buffer, size);
+      txLength += size;
+      return size;
+    }
+
+  private:
+    uint8_t _rx[DFPLAYER_HOST_RX_LENGTH];
+    uint16_t _rxHead = 0;
+    uint16_t _rxTail = 0;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * DFPlayerUsart
+ *
+ * Interrupt driven serial port USART1 for the DFPlayer Mini.
+ *
+ * file   : DFPlayerUsart.cpp
+ */
+
+#include "DFPlayerUsart.h"
+
+#if defined(USART1)
+
+DFPlayerUsart *DFPlayerUsart::instance = nullptr;
+
+void DFPlayerUsart::begin(unsigned long baud, DFRobotDFPlayerMini &player) {
+  _player = &player;
+  begin(baud);
+}
+
+void DFPlayerUsart::begin(unsigned long baud) {
+  instance = this;
+  _txHead = _txTail = 0;
+  _rxHead = _rxTail = 0;
+
+  // TxD - PA1 (output, idle HIGH), RxD - PA2 (input)
+  digitalWrite(PIN_PA1, HIGH);
+  pinMode(PIN_PA1, OUTPUT);
+  pinMode(PIN_PA2, INPUT);
+
+  USART1.BAUD = (uint16_t)((4UL * F_CPU + baud / 2) / baud); // BAUD = 64 * F_CPU / (16 * baud)
+  USART1.CTRLC = USART_CMODE_ASYNCHRONOUS_gc | USART_PMODE_DISABLED_gc | USART_SBMODE_1BIT_gc | USART_CHSIZE_8BIT_gc;
+  USART1.CTRLA = USART_RXCIE_bm;
+  USART1.CTRLB = USART_RXEN_bm | USART_TXEN_bm;
+}
+
+void DFPlayerUsart::end() {
+  flush();
+  USART1.CTRLA = 0;
+  USART1.CTRLB = 0;
+  instance = nullptr;
+}
+
+int DFPlayerUsart::available() {
+  return (_rxHead - _rxTail) & (DFPLAYER_USART_RX_LENGTH - 1);
+}
+
+int DFPlayerUsart::read() {
+  if (_rxHead == _rxTail) return -1;
+  uint8_t data = _rxBuffer[_rxTail];
+  _rxTail = (_rxTail + 1) & (DFPLAYER_USART_RX_LENGTH - 1);
+  return data;
+}
+
+int DFPlayerUsart::peek() {
+  if (_rxHead == _rxTail) return -1;
+  return _rxBuffer[_rxTail];
+}
+
+void DFPlayerUsart::flush() {
+  while (_txHead != _txTail);                      // wait for the buffer
+  while (!(USART1.STATUS & USART_DREIF_bm));       // and for the last byte
+}
+
+size_t DFPlayerUsart::write(uint8_t data) {
+  uint8_t next = (_txHead + 1) & (DFPLAYER_USART_TX_LENGTH - 1);
+
+  while (next == _txTail); // the buffer is full - wait for the interrupt
+
+  _txBuffer[_txHead] = data;
+  _txHead = next;
+  USART1.CTRLA |= USART_DREIE_bm; // start sending
+  return 1;
+}
+
+size_t DFPlayerUsart::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    DFPlayerUsart::write(buffer[i]);
+  }
+  return size;
+}
+
+void DFPlayerUsart::rxComplete() {
+  uint8_t data = USART1.RXDATAL;
+
+  if (_player) {
+    _player->receiveByte(data);   // frame assembling
+    return;
+  }
+
+  uint8_t next = (_rxHead + 1) & (DFPLAYER_USART_RX_LENGTH - 1);
+  if (next != _rxTail) {          // if the buffer is full the byte is lost
+    _rxBuffer[_rxHead] = data;
+    _rxHead = next;
+  }
+}
+
+void DFPlayerUsart::dataRegisterEmpty() {
+  if (_txHead == _txTail) {
+    USART1.CTRLA &= ~USART_DREIE_bm; // nothing to send
+    return;
+  }
+  USART1.TXDATAL = _txBuffer[_txTail];
+  _txTail = (_txTail + 1) & (DFPLAYER_USART_TX_LENGTH - 1);
+}
+
+ISR(USART1_RXC_vect) {
+  if (DFPlayerUsart::instance) DFPlayerUsart::instance->rxComplete();
+  else (void)USART1.RXDATAL;
+}
+
+ISR(USART1_DRE_vect) {
+  if (DFPlayerUsart::instance) DFPlayerUsart::instance->dataRegisterEmpty();
+  else USART1.CTRLA &= ~USART_DREIE_bm;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * DFPlayerUsart
+ *
+ * Interrupt driven serial port USART1 for the DFPlayer Mini.
+ *
+ * file   : DFPlayerUsart.h
+ *
+ *   The received bytes are passed to DFRobotDFPlayerMini::receiveByte() directly
+ *   from the RX complete interrupt, so the player frames are assembled and stored
+ *   in the ring of messages even when the main loop is blocked.
+ *   Sent bytes are buffered and written by the data register empty interrupt.
+ *
+ *   The class replaces Serial1 - Serial1 must not be used in the sketch,
+ *   because it owns the same interrupt vectors.
+ *
+ *   Usage:
+ *          DFPlayerUsart playerSerial;
+ *          playerSerial.begin(9600, myDFPlayer);
+ *          myDFPlayer.begin(playerSerial);
+ */
+
+#ifndef DFPLAYER_USART_H
+#define DFPLAYER_USART_H
+
+#include "Arduino.h"
+#include "DFRobotDFPlayerMini.h"
+
+#define DFPLAYER_USART_TX_LENGTH 16 // transmit buffer length (must be a power of 2)
+#define DFPLAYER_USART_RX_LENGTH 16 // receive buffer length if no player is attached (must be a power of 2)
+
+class DFPlayerUsart final : public Stream {
+  public:
+    /// @brief Initializes USART1 (8N1) and enables its interrupts
+    /// @param baud Baud rate (9600 for DFPlayer Mini)
+    /// @param player Player, the received bytes are passed to (in the interrupt)
+    void begin(unsigned long baud, DFRobotDFPlayerMini &player);
+
+    /// @brief Initializes USART1 without a player - received bytes are stored in the buffer
+    /// @param baud Baud rate
+    void begin(unsigned long baud);
+
+    /// @brief Disables USART1 and its interrupts
+    void end();
+
+    /// @brief Returns count of received bytes in the buffer (always 0 if a player is attached)
+    int available();
+
+    /// @brief Reads one byte from the receive buffer
+    /// @return byte or -1 if the buffer is empty
+    int read();
+
+    /// @brief Returns next byte in the receive buffer without removing it
+    /// @return byte or -1 if the buffer is empty
+    int peek();
+
+    /// @brief Waits for all buffered bytes to be sent
+    void flush();
+
+    /// @brief Writes one byte to the transmit buffer; waits if the buffer is full
+    size_t write(uint8_t data);
+
+    /// @brief Writes the buffer (e.g. one player frame) without virtual calls per byte
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    // interrupt handlers
+    void rxComplete();
+    void dataRegisterEmpty();
+
+    static DFPlayerUsart *instance;
+
+  private:
+    DFRobotDFPlayerMini *_player = nullptr;
+
+    uint8_t _txBuffer[DFPLAYER_USART_TX_LENGTH];
+    volatile uint8_t _txHead = 0;
+    volatile uint8_t _txTail = 0;
+
+    uint8_t _rxBuffer[DFPLAYER_USART_RX_LENGTH];
+    volatile uint8_t _rxHead = 0;
+    volatile uint8_t _rxTail = 0;
+};
+
+#endif
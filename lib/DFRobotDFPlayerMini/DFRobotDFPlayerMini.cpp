@@ -22,63 +22,533 @@ void DFRobotDFPlayerMini::uint16ToArray(uint16_t value, uint8_t *array){
   *(array+1) = (uint8_t)(value);
 }
 
-uint16_t DFRobotDFPlayerMini::calculateCheckSum(uint8_t *buffer){
-  uint16_t sum = 0;
-  for (int i=Stack_Version; i<Stack_CheckSum; i++) {
-    sum += buffer[i];
-  }
-  return -sum;
-}
+// constant frames - indexes to the table in flash
+enum {
+  FRAME_NEXT,
+  FRAME_PREVIOUS,
+  FRAME_VOLUME_UP,
+  FRAME_VOLUME_DOWN,
+  FRAME_SLEEP,
+  FRAME_RESET,
+  FRAME_START,
+  FRAME_PAUSE,
+  FRAME_ENABLE_LOOP_ALL,
+  FRAME_DISABLE_LOOP_ALL,
+  FRAME_STOP_ADVERTISE,
+  FRAME_STOP,
+  FRAME_RANDOM_ALL,
+  FRAME_ENABLE_LOOP,
+  FRAME_DISABLE_LOOP,
+  FRAME_ENABLE_DAC,
+  FRAME_DISABLE_DAC
+};
 
-void DFRobotDFPlayerMini::sendStack(){
-  if (_sending[Stack_ACK]) {  //if the ack mode is on wait until the last transmition
-    while (_isSending) {
-      delay(0);
-      waitAvailable();
-    }
+static const DFPlayerFrame frames[] PROGMEM = {
+  dfplayerFrame(0x01),        //FRAME_NEXT
+  dfplayerFrame(0x02),        //FRAME_PREVIOUS
+  dfplayerFrame(0x04),        //FRAME_VOLUME_UP
+  dfplayerFrame(0x05),        //FRAME_VOLUME_DOWN
+  dfplayerFrame(0x0A),        //FRAME_SLEEP
+  dfplayerFrame(0x0C),        //FRAME_RESET
+  dfplayerFrame(0x0D),        //FRAME_START
+  dfplayerFrame(0x0E),        //FRAME_PAUSE
+  dfplayerFrame(0x11, 0x01),  //FRAME_ENABLE_LOOP_ALL
+  dfplayerFrame(0x11, 0x00),  //FRAME_DISABLE_LOOP_ALL
+  dfplayerFrame(0x15),        //FRAME_STOP_ADVERTISE
+  dfplayerFrame(0x16),        //FRAME_STOP
+  dfplayerFrame(0x18),        //FRAME_RANDOM_ALL
+  dfplayerFrame(0x19, 0x00),  //FRAME_ENABLE_LOOP
+  dfplayerFrame(0x19, 0x01),  //FRAME_DISABLE_LOOP
+  dfplayerFrame(0x1A, 0x00),  //FRAME_ENABLE_DAC
+  dfplayerFrame(0x1A, 0x01)   //FRAME_DISABLE_DAC
+};
+
+// frame of the parametrized commands - only the command, the parameter and the checksum are patched
+static const DFPlayerFrame frameTemplate PROGMEM = dfplayerFrame(0x00, 0x0000);
+
+static_assert(dfplayerCheckSum(0x16, 0x0000, 0x01) == 0xFEE4, "stop frame checksum");
+static_assert(sizeof(frames) / sizeof(frames[0]) == FRAME_DISABLE_DAC + 1, "frame table");
+
+void DFRobotDFPlayerMini::buildStack(uint8_t *frame, const Command *slot){
+  uint16_t checkSum;
+  
+  if (slot->frame != DFPLAYER_NO_FRAME) {
+    memcpy_P(frame, frames + slot->frame, DFPLAYER_SEND_LENGTH);
+    checkSum = arrayToUint16(frame+Stack_CheckSum);
+  }
+  else {
+    memcpy_P(frame, &frameTemplate, DFPLAYER_SEND_LENGTH);
+    frame[Stack_Command] = slot->command;
+    uint16ToArray(slot->parameter, frame+Stack_Parameter);
+    checkSum = arrayToUint16(frame+Stack_CheckSum) - slot->command - (uint8_t)(slot->parameter >> 8) - (uint8_t)slot->parameter;
+  }
+  
+  if (!_isACK) { //the frames in flash request the ACK
+    frame[Stack_ACK] = 0x00;
+    checkSum++;
   }
+  uint16ToArray(checkSum, frame+Stack_CheckSum);
+}
 
+void DFRobotDFPlayerMini::sendStack(const uint8_t *frame){
 #ifdef _DEBUG
   Serial.println();
   Serial.print(F("sending:"));
   for (int i=0; i<DFPLAYER_SEND_LENGTH; i++) {
-    Serial.print(_sending[i],HEX);
+    Serial.print(frame[i],HEX);
     Serial.print(F(" "));
   }
   Serial.println();
 #endif
-  _serial->write(_sending, DFPLAYER_SEND_LENGTH);
+  _writeFrame(_port, frame);
   _timeOutTimer = millis();
-  _isSending = _sending[Stack_ACK];
-  
-  if (!_sending[Stack_ACK]) { //if the ack mode is off wait 10 ms after one transmition.
-    delay(10);
-  }
+  count(_stats.framesSent);
 }
 
-void DFRobotDFPlayerMini::sendStack(uint8_t command){
-  sendStack(command, 0);
+uint8_t DFRobotDFPlayerMini::sendFrame(uint8_t frame){
+  return enqueue(pgm_read_byte(&frames[frame].bytes[Stack_Command]),
+                 ((uint16_t)pgm_read_byte(&frames[frame].bytes[Stack_Parameter]) << 8) | pgm_read_byte(&frames[frame].bytes[Stack_Parameter+1]),
+                 0, frame);
 }
 
-void DFRobotDFPlayerMini::sendStack(uint8_t command, uint16_t argument){
-  _sending[Stack_Command] = command;
-  uint16ToArray(argument, _sending+Stack_Parameter);
-  uint16ToArray(calculateCheckSum(_sending), _sending+Stack_CheckSum);
-  sendStack();
+uint8_t DFRobotDFPlayerMini::sendStack(uint8_t command){
+  return sendStack(command, 0);
 }
 
-void DFRobotDFPlayerMini::sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow){
+uint8_t DFRobotDFPlayerMini::sendStack(uint8_t command, uint16_t argument){
+  return enqueue(command, argument, 0);
+}
+
+uint8_t DFRobotDFPlayerMini::sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow){
   uint16_t buffer = argumentHigh;
   buffer <<= 8;
-  sendStack(command, buffer | argumentLow);
+  return sendStack(command, buffer | argumentLow);
+}
+
+uint8_t DFRobotDFPlayerMini::enqueue(uint8_t command, uint16_t argument, uint8_t gap, uint8_t frame){
+  Command *slot = _queue + (_queueHead + _queueCount) % DFPLAYER_QUEUE_LENGTH;
+  
+  //the queue is full - the command is dropped (the sent queries wait for the reply in _pending[])
+  if (_queueCount >= DFPLAYER_QUEUE_LENGTH) {
+    return DFPLAYER_NO_HANDLE;
+  }
+  
+  uint8_t handle = nextHandle(); //the sent query moves to _pending[] in poll()
+  slot->handle = handle;
+  slot->command = command;
+  slot->parameter = argument;
+  slot->status = DFPLAYER_COMMAND_QUEUED;
+  slot->retries = 0;
+  slot->gap = gap;
+  slot->frame = frame;
+  _queueCount++;
+  
+  if (_queueCount == 1) { //nothing waits for the ACK - send it now if the line is free
+    poll();
+  }
+  return handle;
+}
+
+uint8_t DFRobotDFPlayerMini::setState(uint8_t command, uint16_t argument, uint8_t gap, uint8_t frame){
+  uint8_t state = *stateOf(command);
+  Command *pending = nullptr;
+  
+  for (uint8_t i=0; i<_queueCount; i++) { //the last queued setting decides the future state
+    Command *slot = _queue + (_queueHead + i) % DFPLAYER_QUEUE_LENGTH;
+    if (slot->command == command) {
+      pending = slot;
+    }
+    else if ((slot->command == 0x0C) || ((command == 0x09) && (slot->command == 0x0A)) || //reset, sleep (device is selected again to wake)
+             ((command == 0x19) && !keepsLoop(slot->command))) { //new track
+      pending = nullptr;
+      state = DFPLAYER_STATE_UNKNOWN;
+    }
+  }
+  
+  if (pending ? (pending->parameter == argument) : ((argument < DFPLAYER_STATE_UNKNOWN) && (state == argument))) { //no change - nothing to send
+    if (pending) {
+      return pending->handle;
+    }
+    return DFPLAYER_SET_HANDLE;
+  }
+  return enqueue(command, argument, gap, frame);
+}
+
+uint8_t* DFRobotDFPlayerMini::stateOf(uint8_t command){
+  switch (command) {
+    case 0x06:
+      return &_volume;
+    case 0x07:
+      return &_eq;
+    case 0x09:
+      return &_device;
+    case 0x19:
+      return &_loop;
+    default:
+      return nullptr;
+  }
+}
+
+bool DFRobotDFPlayerMini::keepsLoop(uint8_t command){
+  switch (command) {
+    case 0x04: //volume, EQ and device settings do not change the played track
+    case 0x05:
+    case 0x06:
+    case 0x07:
+    case 0x09:
+    case 0x19:
+      return true;
+    default:
+      return isQuery(command);
+  }
+}
+
+void DFRobotDFPlayerMini::updateState(uint8_t command, uint16_t parameter, uint8_t status){
+  uint8_t *state = stateOf(command);
+  
+  if (state) {
+    //the failed setting may have been received - the state is not known
+    *state = ((status == DFPLAYER_COMMAND_DONE) && (parameter < DFPLAYER_STATE_UNKNOWN)) ? parameter : DFPLAYER_STATE_UNKNOWN;
+    return;
+  }
+  
+  switch (command) {
+    case 0x04: //volume up / down within 0 - 30
+      if ((status == DFPLAYER_COMMAND_DONE) && (_volume < 30)) {
+        _volume++;
+      }
+      else if (status != DFPLAYER_COMMAND_DONE) {
+        _volume = DFPLAYER_STATE_UNKNOWN;
+      }
+      break;
+    case 0x05:
+      if ((status == DFPLAYER_COMMAND_DONE) && (_volume > 0) && (_volume <= 30)) {
+        _volume--;
+      }
+      else if (status != DFPLAYER_COMMAND_DONE) {
+        _volume = DFPLAYER_STATE_UNKNOWN;
+      }
+      break;
+    case 0x0C: //reset - the player starts with its defaults
+      clearState();
+      break;
+    case 0x0A: //sleep - the player wakes up when the device is selected again
+      _device = DFPLAYER_STATE_UNKNOWN;
+      _loop = DFPLAYER_STATE_UNKNOWN;
+      break;
+    default:   //the single loop belongs to the played track
+      if (!keepsLoop(command)) {
+        _loop = DFPLAYER_STATE_UNKNOWN;
+      }
+      break;
+  }
+}
+
+void DFRobotDFPlayerMini::clearState(){
+  _volume = DFPLAYER_STATE_UNKNOWN;
+  _eq = DFPLAYER_STATE_UNKNOWN;
+  _device = DFPLAYER_STATE_UNKNOWN;
+  _loop = DFPLAYER_STATE_UNKNOWN;
+}
+
+uint8_t DFRobotDFPlayerMini::nextHandle(){
+  do { //after the wrap the handles still held by the slots and the cache are skipped
+    _lastHandle++;
+  } while ((_lastHandle == DFPLAYER_NO_HANDLE) || (_lastHandle == DFPLAYER_SET_HANDLE) || isHandleUsed(_lastHandle));
+  return _lastHandle;
+}
+
+bool DFRobotDFPlayerMini::isHandleUsed(uint8_t handle){
+  if (findHandle(handle)) {
+    return true;
+  }
+  for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) {
+    if (_cache[i].command && (_cache[i].handle == handle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void DFRobotDFPlayerMini::poll(){
+  uint16_t now = millis();
+  
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) { //queries waiting for the reply
+    Command *slot = _pending + i;
+    if ((slot->status == DFPLAYER_COMMAND_SENT) && ((uint16_t)(now - slot->sent) > _timeOutDuration)) {
+      slot->status = DFPLAYER_COMMAND_FAILED;
+      count(_stats.queryTimeouts);
+    }
+  }
+  
+  if (!_queueCount) {
+    return;
+  }
+  
+  Command *slot = _queue + _queueHead;
+  
+  if (slot->status == DFPLAYER_COMMAND_SENT) { //waiting for the ACK
+    if (millis() - _timeOutTimer < DFPLAYER_ACK_TIMEOUT) {
+      return;
+    }
+    count(_stats.ackTimeouts);
+    if (slot->retries >= DFPLAYER_RETRANSMIT) {
+      completeCommand(DFPLAYER_COMMAND_FAILED);
+      return;
+    }
+    slot->retries++;
+    count(_stats.retransmits);
+  }
+  else if (millis() - _timeOutTimer < _sendGap) { //the player is not ready for the next frame
+    return;
+  }
+  
+  uint8_t frame[DFPLAYER_SEND_LENGTH];
+  buildStack(frame, slot);
+  sendStack(frame);
+  _sentCommand = slot->command;
+  
+  slot->status = DFPLAYER_COMMAND_SENT;
+  slot->sent = _timeOutTimer;
+  
+  if (_isACK) {
+    _isSending = true;
+  }
+  else { //if the ack mode is off the next frame is sent at least 10 ms later, the query waits for its reply
+    if (isQuery(slot->command)) {
+      nextCommand();
+    }
+    else {
+      completeCommand(DFPLAYER_COMMAND_DONE);
+    }
+    if (_sendGap < DFPLAYER_FRAME_GAP) {
+      _sendGap = DFPLAYER_FRAME_GAP;
+    }
+  }
+}
+
+void DFRobotDFPlayerMini::nextCommand(){
+  if (_queue[_queueHead].status == DFPLAYER_COMMAND_SENT) { //the query waits for its reply, its slot is freed
+    pendQuery(_queue + _queueHead);
+  }
+  _sendGap = _queue[_queueHead].gap;
+  _queueHead = (_queueHead + 1) % DFPLAYER_QUEUE_LENGTH;
+  _queueCount--;
+  _isSending = false;
+}
+
+void DFRobotDFPlayerMini::completeCommand(uint8_t status){
+  _queue[_queueHead].status = status;
+  updateState(_queue[_queueHead].command, _queue[_queueHead].parameter, status);
+  nextCommand();
+}
+
+void DFRobotDFPlayerMini::pendQuery(Command *slot){
+  Command *pending = nullptr;
+  uint16_t now = millis();
+  
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) { //a free entry, or the oldest query is given up
+    Command *entry = _pending + i;
+    if (entry->status != DFPLAYER_COMMAND_SENT) {
+      pending = entry;
+      break;
+    }
+    if (!pending || ((uint16_t)(now - entry->sent) > (uint16_t)(now - pending->sent))) {
+      pending = entry;
+    }
+  }
+  if (pending->status == DFPLAYER_COMMAND_SENT) {
+    count(_stats.queryTimeouts);
+  }
+  *pending = *slot;
+  
+  slot->handle = DFPLAYER_NO_HANDLE; //the handle is found in _pending[]
+  slot->status = DFPLAYER_COMMAND_UNKNOWN;
+}
+
+DFRobotDFPlayerMini::Command* DFRobotDFPlayerMini::findHandle(uint8_t handle){
+  if (handle == DFPLAYER_NO_HANDLE) {
+    return nullptr;
+  }
+  for (uint8_t i=0; i<DFPLAYER_QUEUE_LENGTH; i++) {
+    if (_queue[i].handle == handle) {
+      return _queue + i;
+    }
+  }
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) {
+    if (_pending[i].handle == handle) {
+      return _pending + i;
+    }
+  }
+  return nullptr;
+}
+
+DFRobotDFPlayerMini::Command* DFRobotDFPlayerMini::findQuery(uint8_t command){
+  Command *found = nullptr;
+  uint16_t now = millis();
+  uint16_t age = 0;
+  
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) { //the oldest query with this command gets the reply
+    Command *slot = _pending + i;
+    if ((slot->status == DFPLAYER_COMMAND_SENT) && (slot->command == command)) {
+      if (!found || ((uint16_t)(now - slot->sent) > age)) {
+        found = slot;
+        age = now - slot->sent;
+      }
+    }
+  }
+  if (!found && _isSending && (_queue[_queueHead].command == command)) { //the reply came before the ACK
+    found = _queue + _queueHead;
+  }
+  return found;
+}
+
+bool DFRobotDFPlayerMini::isIdle(){
+  return !_queueCount;
+}
+
+bool DFRobotDFPlayerMini::waitIdle(unsigned long duration){
+  unsigned long timer = millis();
+  if (!duration) {
+    duration = _timeOutDuration;
+  }
+  while (!isIdle()){
+    if (millis() - timer > duration) {
+      return false;
+    }
+    available();
+    delay(0);
+  }
+  return true;
+}
+
+uint8_t DFRobotDFPlayerMini::commandStatus(uint8_t handle){
+  if (handle == DFPLAYER_NO_HANDLE) {
+    return DFPLAYER_COMMAND_FAILED;
+  }
+  if (handle == DFPLAYER_SET_HANDLE) { //nothing to send, the player is already set
+    return DFPLAYER_COMMAND_DONE;
+  }
+  Command *slot = findHandle(handle);
+  if (slot) {
+    return slot->status;
+  }
+  for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) {
+    if (_cache[i].command && (_cache[i].handle == handle)) { //answered from the cache
+      return DFPLAYER_COMMAND_DONE;
+    }
+  }
+  return DFPLAYER_COMMAND_UNKNOWN;
+}
+
+bool DFRobotDFPlayerMini::commandDone(uint8_t handle){
+  uint8_t status = commandStatus(handle);
+  return (status != DFPLAYER_COMMAND_QUEUED) && (status != DFPLAYER_COMMAND_SENT);
+}
+
+bool DFRobotDFPlayerMini::isQuery(uint8_t command){
+  return (command >= 0x42) && (command <= 0x4F);
+}
+
+bool DFRobotDFPlayerMini::isCacheable(uint8_t command){
+  switch (command) {
+    case 0x47: //file counts (U-disk, SD, flash)
+    case 0x48:
+    case 0x49:
+    case 0x4E: //file counts in folder
+    case 0x4F: //folder counts
+      return true;
+    default:   //state, volume, EQ and the current file change during playback
+      return false;
+  }
+}
+
+uint8_t DFRobotDFPlayerMini::query(uint8_t command, uint16_t parameter){
+  if (isCacheable(command) && (parameter <= 0xFF)) {
+    for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) {
+      if ((_cache[i].command == command) && (_cache[i].parameter == parameter)) { //no round-trip, the handle of the entry
+        return _cache[i].handle;
+      }
+    }
+  }
+  for (uint8_t i=0; i<DFPLAYER_QUEUE_LENGTH; i++) { //the same query is already in progress
+    if ((_queue[i].command == command) && (_queue[i].parameter == parameter) &&
+        ((_queue[i].status == DFPLAYER_COMMAND_QUEUED) || (_queue[i].status == DFPLAYER_COMMAND_SENT))) {
+      return _queue[i].handle;
+    }
+  }
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) { //the reply is the value of the last parameter - the query waits for it
+    if ((_pending[i].command == command) && (_pending[i].parameter == parameter) && (_pending[i].status == DFPLAYER_COMMAND_SENT)) {
+      return _pending[i].handle;
+    }
+  }
+  return enqueue(command, parameter, 0);
+}
+
+int DFRobotDFPlayerMini::queryValue(uint8_t handle){
+  Command *slot = findHandle(handle);
+  if (slot && (slot->status == DFPLAYER_COMMAND_DONE) && isQuery(slot->command)) {
+    return slot->parameter;
+  }
+  for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) {
+    if (_cache[i].command && (_cache[i].handle == handle)) {
+      return _cache[i].value;
+    }
+  }
+  return -1;
+}
+
+void DFRobotDFPlayerMini::storeCache(uint8_t command, uint16_t parameter, uint16_t value, uint8_t handle){
+  if (!isCacheable(command) || (parameter > 0xFF)) {
+    return;
+  }
+  CacheEntry *entry = nullptr;
+  for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) { //the same query answered again
+    if ((_cache[i].command == command) && (_cache[i].parameter == parameter)) {
+      entry = _cache + i;
+    }
+  }
+  if (!entry) {
+    entry = _cache + _cacheNext;
+    _cacheNext = (_cacheNext + 1) % DFPLAYER_CACHE_LENGTH;
+  }
+  
+  entry->command = command;
+  entry->parameter = parameter;
+  entry->value = value;
+  entry->handle = handle; //the handle of the query stays valid after its slot is reused
+}
+
+void DFRobotDFPlayerMini::clearCache(){
+  for (uint8_t i=0; i<DFPLAYER_CACHE_LENGTH; i++) {
+    _cache[i].command = 0x00;
+  }
+}
+
+void DFRobotDFPlayerMini::pushEvent(uint8_t type, uint16_t parameter){
+  if (_eventCount >= DFPLAYER_EVENT_LENGTH) { //the ring is full, the event is lost
+    return;
+  }
+  Event *event = _events + (_eventHead + _eventCount) % DFPLAYER_EVENT_LENGTH;
+  event->type = type;
+  event->parameter = parameter;
+  _eventCount++;
+}
+
+int DFRobotDFPlayerMini::waitQuery(uint8_t handle){
+  while (!commandDone(handle)) { //always ends - the query is answered, fails or times out
+    available();
+    delay(0);
+  }
+  return queryValue(handle);
 }
 
 void DFRobotDFPlayerMini::enableACK(){
-  _sending[Stack_ACK] = 0x01;
+  _isACK = true;
 }
 
 void DFRobotDFPlayerMini::disableACK(){
-  _sending[Stack_ACK] = 0x00;
+  _isACK = false;
 }
 
 bool DFRobotDFPlayerMini::waitAvailable(unsigned long duration){
@@ -88,6 +558,7 @@ bool DFRobotDFPlayerMini::waitAvailable(unsigned long duration){
   }
   while (!available()){
     if (millis() - timer > duration) {
+      count(_stats.timeOuts);
       return handleError(TimeOut);
     }
     delay(0);
@@ -95,8 +566,40 @@ bool DFRobotDFPlayerMini::waitAvailable(unsigned long duration){
   return true;
 }
 
+int DFRobotDFPlayerMini::streamRead(void *port){
+  Stream *stream = static_cast<Stream*>(port);
+  return stream->available() ? stream->read() : -1;
+}
+
+void DFRobotDFPlayerMini::streamWrite(void *port, const uint8_t *frame){
+  static_cast<Stream*>(port)->write(frame, DFPLAYER_SEND_LENGTH);
+}
+
 bool DFRobotDFPlayerMini::begin(Stream &stream, bool isACK, bool doReset){
-  _serial = &stream;
+  return begin(&stream, streamRead, streamWrite, isACK, doReset);
+}
+
+bool DFRobotDFPlayerMini::begin(void *port, int (*readByte)(void *port), void (*writeFrame)(void *port, const uint8_t *frame), bool isACK, bool doReset){
+  _port = port;
+  _readByte = readByte;
+  _writeFrame = writeFrame;
+  _messageHead = _messageTail;
+  _eventCount = 0;
+  _isAvailable = false;
+  _queueHead = 0;
+  _queueCount = 0;
+  for (uint8_t i=0; i<DFPLAYER_QUEUE_LENGTH; i++) { //the handles of the previous session are not valid
+    _queue[i].handle = DFPLAYER_NO_HANDLE;
+    _queue[i].status = DFPLAYER_COMMAND_UNKNOWN;
+  }
+  for (uint8_t i=0; i<DFPLAYER_PENDING_LENGTH; i++) {
+    _pending[i].handle = DFPLAYER_NO_HANDLE;
+    _pending[i].status = DFPLAYER_COMMAND_UNKNOWN;
+  }
+  _sendGap = 0;
+  _isSending = false;
+  clearCache();
+  clearState();
   
   if (isACK) {
     enableACK();
@@ -129,7 +632,6 @@ uint16_t DFRobotDFPlayerMini::read(){
 }
 
 bool DFRobotDFPlayerMini::handleMessage(uint8_t type, uint16_t parameter){
-  _receivedIndex = 0;
   _handleType = type;
   _handleParameter = parameter;
   _isAvailable = true;
@@ -138,7 +640,6 @@ bool DFRobotDFPlayerMini::handleMessage(uint8_t type, uint16_t parameter){
 
 bool DFRobotDFPlayerMini::handleError(uint8_t type, uint16_t parameter){
   handleMessage(type, parameter);
-  _isSending = false;
   return false;
 }
 
@@ -147,69 +648,126 @@ uint8_t DFRobotDFPlayerMini::readCommand(){
   return _handleCommand;
 }
 
-void DFRobotDFPlayerMini::parseStack(){
-  uint8_t handleCommand = *(_received + Stack_Command);
-  if (handleCommand == 0x41) { //handle the 0x41 ack feedback as a spcecial case, in case the pollusion of _handleCommand, _handleParameter, and _handleType.
-    _isSending = false;
+void DFRobotDFPlayerMini::parseStack(uint8_t command, uint16_t parameter){
+  if (command == 0x41) { //the 0x41 ack feedback belongs to the sent frame, it is not a message
+    if (_isSending) {
+      countLatency(_stats.ackLatency, millis() - _timeOutTimer);
+      if (isQuery(_queue[_queueHead].command)) { //the query waits for its reply, the next frame can be sent
+        nextCommand();
+      }
+      else {
+        completeCommand(DFPLAYER_COMMAND_DONE);
+      }
+    }
     return;
   }
   
-  _handleCommand = handleCommand;
-  _handleParameter =  arrayToUint16(_received + Stack_Parameter);
+  if (isQuery(command)) { //the reply belongs to the oldest query with the same command
+    Command *slot = findQuery(command);
+    if (slot) {
+      countLatency(_stats.queryLatency, (uint16_t)millis() - slot->sent);
+      storeCache(command, slot->parameter, parameter, slot->handle);
+      if (command == 0x43) { //the read volume / EQ syncs the shadow
+        _volume = parameter;
+      }
+      else if (command == 0x44) {
+        _eq = parameter;
+      }
+      slot->parameter = parameter; //the value for queryValue()
+      if (_isSending && (slot == _queue + _queueHead)) { //the reply came before the ACK
+        completeCommand(DFPLAYER_COMMAND_DONE);
+      }
+      else {
+        slot->status = DFPLAYER_COMMAND_DONE;
+      }
+    }
+    return; //a late reply of the failed query is dropped
+  }
+  
+  _handleCommand = command;
+  _handleParameter = parameter;
+
+  if (_isSending) {
+    if (_handleCommand == 0x40) {
+      switch (_handleParameter) {
+        case SerialWrongStack:
+        case CheckSumNotMatch: //the frame was damaged on the way, send it again
+          if (_queue[_queueHead].retries < DFPLAYER_RETRANSMIT) {
+            _queue[_queueHead].status = DFPLAYER_COMMAND_QUEUED;
+            _queue[_queueHead].retries++;
+            count(_stats.retransmits);
+            _isSending = false;
+            _sendGap = 0;
+          }
+          else {
+            completeCommand(DFPLAYER_COMMAND_ERROR);
+          }
+          break;
+        case Busy:
+        case Sleeping:
+          completeCommand(DFPLAYER_COMMAND_ERROR);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+  else if ((_handleCommand == 0x40) && isQuery(_sentCommand)) { //the error answers the acknowledged query (missing folder...)
+    Command *slot = findQuery(_sentCommand);
+    if (slot) {
+      slot->status = DFPLAYER_COMMAND_ERROR;
+      count(_stats.playerErrors);
+      return; //the answer of the query, not an event
+    }
+  }
 
   switch (_handleCommand) {
     case 0x3C:
     case 0x3D:
-      handleMessage(DFPlayerPlayFinished, _handleParameter);
+      pushEvent(DFPlayerPlayFinished, _handleParameter);
       break;
     case 0x3F:
+      clearCache(); //the card was changed, the cached counts are not valid
+      clearState();
       if (_handleParameter & 0x01) {
-        handleMessage(DFPlayerUSBOnline, _handleParameter);
+        pushEvent(DFPlayerUSBOnline, _handleParameter);
       }
       else if (_handleParameter & 0x02) {
-        handleMessage(DFPlayerCardOnline, _handleParameter);
+        pushEvent(DFPlayerCardOnline, _handleParameter);
       }
       else if (_handleParameter & 0x03) {
-        handleMessage(DFPlayerCardUSBOnline, _handleParameter);
+        pushEvent(DFPlayerCardUSBOnline, _handleParameter);
       }
       break;
     case 0x3A:
+      clearCache(); //the card was changed, the cached counts are not valid
+      clearState();
       if (_handleParameter & 0x01) {
-        handleMessage(DFPlayerUSBInserted, _handleParameter);
+        pushEvent(DFPlayerUSBInserted, _handleParameter);
       }
       else if (_handleParameter & 0x02) {
-        handleMessage(DFPlayerCardInserted, _handleParameter);
+        pushEvent(DFPlayerCardInserted, _handleParameter);
       }
       break;
     case 0x3B:
+      clearCache(); //the card was changed, the cached counts are not valid
+      clearState();
       if (_handleParameter & 0x01) {
-        handleMessage(DFPlayerUSBRemoved, _handleParameter);
+        pushEvent(DFPlayerUSBRemoved, _handleParameter);
       }
       else if (_handleParameter & 0x02) {
-        handleMessage(DFPlayerCardRemoved, _handleParameter);
+        pushEvent(DFPlayerCardRemoved, _handleParameter);
       }
       break;
     case 0x40:
-      handleMessage(DFPlayerError, _handleParameter);
+      count(_stats.playerErrors);
+      pushEvent(DFPlayerError, _handleParameter);
       break;
     case 0x3E:
-    case 0x42:
-    case 0x43:
-    case 0x44:
-    case 0x45:
-    case 0x46:
-    case 0x47:
-    case 0x48:
-    case 0x49:
-    case 0x4B:
-    case 0x4C:
-    case 0x4D:
-    case 0x4E:
-    case 0x4F:
-      handleMessage(DFPlayerFeedBack, _handleParameter);
+      pushEvent(DFPlayerFeedBack, _handleParameter);
       break;
     default:
-      handleError(WrongStack);
+      pushEvent(WrongStack);
       break;
   }
 }
@@ -221,306 +779,336 @@ uint16_t DFRobotDFPlayerMini::arrayToUint16(uint8_t *array){
   return value;
 }
 
-bool DFRobotDFPlayerMini::validateStack(){
-  return calculateCheckSum(_received) == arrayToUint16(_received+Stack_CheckSum);
+void DFRobotDFPlayerMini::count(uint16_t &counter){
+  if (counter != 0xFFFF) {
+    counter++;
+  }
+}
+
+void DFRobotDFPlayerMini::countLatency(uint16_t *histogram, uint16_t duration){
+  uint8_t bucket = 0;
+  while ((duration >>= 1) && (bucket < DFPLAYER_LATENCY_BUCKETS - 1)) {
+    bucket++;
+  }
+  count(histogram[bucket]);
 }
 
-bool DFRobotDFPlayerMini::available(){
-  while (_serial->available()) {
-    delay(0);
-    if (_receivedIndex == 0) {
-      _received[Stack_Header] = _serial->read();
-#ifdef _DEBUG
-      Serial.print(F("received:"));
-      Serial.print(_received[_receivedIndex],HEX);
-      Serial.print(F(" "));
-#endif
-      if (_received[Stack_Header] == 0x7E) {
-        _receivedIndex ++;
-      }
+DFPlayerStats DFRobotDFPlayerMini::stats(){
+  noInterrupts(); //the receive counters are written in the interrupt
+  DFPlayerStats copy = _stats;
+  interrupts();
+  return copy;
+}
+
+void DFRobotDFPlayerMini::clearStats(){
+  noInterrupts();
+  memset(&_stats, 0, sizeof(_stats));
+  interrupts();
+}
+
+void DFRobotDFPlayerMini::pushMessage(uint8_t command, uint16_t parameter){
+  uint8_t tail = _messageTail;
+  uint8_t next = (tail + 1) & (DFPLAYER_MESSAGE_LENGTH - 1);
+  
+  if (next == _messageHead) { //the ring is full, the message is lost
+    count(_stats.overruns);
+    return;
+  }
+  _messages[tail].command = command;
+  _messages[tail].parameter = parameter;
+  _messageTail = next;
+}
+
+bool DFRobotDFPlayerMini::checkByte(uint8_t index, uint8_t data){
+  switch (index) {
+    case Stack_Version:
+      _receivedSum = data;
+      return data == 0xFF;
+    case Stack_Length:
+      _receivedSum += data;
+      return data == 0x06;
+    case Stack_Command:
+    case Stack_ACK:
+    case Stack_Parameter:
+    case Stack_Parameter+1:
+      _receivedSum += data;
+      return true;
+    default: //header, checksum
+      return true;
+  }
+}
+
+void DFRobotDFPlayerMini::resync(){
+  uint8_t length = _receivedIndex;
+  _receivedIndex = 0;
+  
+  for (uint8_t start=1; start<length; start++) { //the next header candidate in the already buffered bytes
+    if (_received[start] != 0x7E) {
+      continue;
     }
-    else{
-      _received[_receivedIndex] = _serial->read();
-#ifdef _DEBUG
-      Serial.print(_received[_receivedIndex],HEX);
-      Serial.print(F(" "));
-#endif
-      switch (_receivedIndex) {
-        case Stack_Version:
-          if (_received[_receivedIndex] != 0xFF) {
-            return handleError(WrongStack);
-          }
-          break;
-        case Stack_Length:
-          if (_received[_receivedIndex] != 0x06) {
-            return handleError(WrongStack);
-          }
-          break;
-        case Stack_End:
+    uint8_t index = 1;
+    while ((start + index < length) && checkByte(index, _received[start + index])) {
+      index++;
+    }
+    if (start + index == length) { //valid so far - the frame continues with the next received byte
+      memmove(_received, _received + start, index);
+      _receivedIndex = index;
+      count(_stats.resyncs);
+      return;
+    }
+  }
+}
+
+void DFRobotDFPlayerMini::receiveByte(uint8_t data){
+  if ((_receivedIndex == 0) && (data != 0x7E)) { //noise between the frames
+    return;
+  }
+  
+  uint8_t index = _receivedIndex;
+  _received[_receivedIndex++] = data;
+  
+  if (!checkByte(index, data)) {
+    count((index == Stack_Version) ? _stats.headerErrors : _stats.lengthErrors);
+  }
+  else if (index < Stack_End) {
+    return;
+  }
+  else if (data != 0xEF) {
+    count(_stats.endErrors);
+  }
+  else if ((uint16_t)-_receivedSum != arrayToUint16(_received+Stack_CheckSum)) {
+    count(_stats.checkSumErrors);
+  }
+  else {
+    _receivedIndex = 0;
+    count(_stats.framesReceived);
+    pushMessage(_received[Stack_Command], arrayToUint16(_received+Stack_Parameter));
+    return;
+  }
+  
+  pushMessage(0x00, WrongStack);
+  resync(); //the next frame may have started in the damaged one
+}
+
+uint8_t DFRobotDFPlayerMini::receivedLength(){
+  return _receivedIndex; //bytes of the incomplete frame, always less than DFPLAYER_RECEIVED_LENGTH
+}
+
+bool DFRobotDFPlayerMini::available(){
+  int data;
+  while ((data = _readByte(_port)) >= 0) { //bytes not received by the interrupt
+    receiveByte(data);
+  }
+  return update();
+}
+
+bool DFRobotDFPlayerMini::update(){
+  while (_messageHead != _messageTail) {
+    Message *message = _messages + _messageHead;
 #ifdef _DEBUG
-          Serial.println();
+    Serial.print(F("received:"));
+    Serial.print(message->command,HEX);
+    Serial.print(F(" "));
+    Serial.println(message->parameter,HEX);
 #endif
-          if (_received[_receivedIndex] != 0xEF) {
-            return handleError(WrongStack);
-          }
-          else{
-            if (validateStack()) {
-              _receivedIndex = 0;
-              parseStack();
-              return _isAvailable;
-            }
-            else{
-              return handleError(WrongStack);
-            }
-          }
-          break;
-        default:
-          break;
-      }
-      _receivedIndex++;
-    }
+    parseStack(message->command, message->parameter);
+    _messageHead = (_messageHead + 1) & (DFPLAYER_MESSAGE_LENGTH - 1);
   }
   
+  poll();
   
+  if (!_isAvailable && _eventCount) { //the next event, when the previous one was read
+    handleMessage(_events[_eventHead].type, _events[_eventHead].parameter);
+    _eventHead = (_eventHead + 1) % DFPLAYER_EVENT_LENGTH;
+    _eventCount--;
+  }
   return _isAvailable;
 }
 
-void DFRobotDFPlayerMini::next(){
-  sendStack(0x01);
+uint8_t DFRobotDFPlayerMini::next(){
+  return sendFrame(FRAME_NEXT);
 }
 
-void DFRobotDFPlayerMini::previous(){
-  sendStack(0x02);
+uint8_t DFRobotDFPlayerMini::previous(){
+  return sendFrame(FRAME_PREVIOUS);
 }
 
-void DFRobotDFPlayerMini::play(int fileNumber){
-  sendStack(0x03, fileNumber);
+uint8_t DFRobotDFPlayerMini::play(int fileNumber){
+  return sendStack(0x03, fileNumber);
 }
 
-void DFRobotDFPlayerMini::volumeUp(){
-  sendStack(0x04);
+uint8_t DFRobotDFPlayerMini::volumeUp(){
+  return sendFrame(FRAME_VOLUME_UP);
 }
 
-void DFRobotDFPlayerMini::volumeDown(){
-  sendStack(0x05);
+uint8_t DFRobotDFPlayerMini::volumeDown(){
+  return sendFrame(FRAME_VOLUME_DOWN);
 }
 
-void DFRobotDFPlayerMini::volume(uint8_t volume){
-  sendStack(0x06, volume);
+uint8_t DFRobotDFPlayerMini::volume(uint8_t volume){
+  return setState(0x06, volume);
 }
 
-void DFRobotDFPlayerMini::EQ(uint8_t eq) {
-  sendStack(0x07, eq);
+uint8_t DFRobotDFPlayerMini::EQ(uint8_t eq) {
+  return setState(0x07, eq);
 }
 
-void DFRobotDFPlayerMini::loop(int fileNumber) {
-  sendStack(0x08, fileNumber);
+uint8_t DFRobotDFPlayerMini::loop(int fileNumber) {
+  return sendStack(0x08, fileNumber);
 }
 
-void DFRobotDFPlayerMini::outputDevice(uint8_t device) {
-  sendStack(0x09, device);
-  delay(200);
+uint8_t DFRobotDFPlayerMini::outputDevice(uint8_t device) {
+  return setState(0x09, device, 200); //the player needs 200 ms to switch the device
 }
 
-void DFRobotDFPlayerMini::sleep(){
-  sendStack(0x0A);
+uint8_t DFRobotDFPlayerMini::sleep(){
+  return sendFrame(FRAME_SLEEP);
 }
 
-void DFRobotDFPlayerMini::reset(){
-  sendStack(0x0C);
+uint8_t DFRobotDFPlayerMini::reset(){
+  return sendFrame(FRAME_RESET);
 }
 
-void DFRobotDFPlayerMini::start(){
-  sendStack(0x0D);
+uint8_t DFRobotDFPlayerMini::start(){
+  return sendFrame(FRAME_START);
 }
 
-void DFRobotDFPlayerMini::pause(){
-  sendStack(0x0E);
+uint8_t DFRobotDFPlayerMini::pause(){
+  return sendFrame(FRAME_PAUSE);
 }
 
-void DFRobotDFPlayerMini::playFolder(uint8_t folderNumber, uint8_t fileNumber){
-  sendStack(0x0F, folderNumber, fileNumber);
+uint8_t DFRobotDFPlayerMini::playFolder(uint8_t folderNumber, uint8_t fileNumber){
+  return sendStack(0x0F, folderNumber, fileNumber);
 }
 
-void DFRobotDFPlayerMini::outputSetting(bool enable, uint8_t gain){
-  sendStack(0x10, enable, gain);
+uint8_t DFRobotDFPlayerMini::outputSetting(bool enable, uint8_t gain){
+  return sendStack(0x10, enable, gain);
 }
 
-void DFRobotDFPlayerMini::enableLoopAll(){
-  sendStack(0x11, 0x01);
+uint8_t DFRobotDFPlayerMini::enableLoopAll(){
+  return sendFrame(FRAME_ENABLE_LOOP_ALL);
 }
 
-void DFRobotDFPlayerMini::disableLoopAll(){
-  sendStack(0x11, 0x00);
+uint8_t DFRobotDFPlayerMini::disableLoopAll(){
+  return sendFrame(FRAME_DISABLE_LOOP_ALL);
 }
 
-void DFRobotDFPlayerMini::playMp3Folder(int fileNumber){
-  sendStack(0x12, fileNumber);
+uint8_t DFRobotDFPlayerMini::playMp3Folder(int fileNumber){
+  return sendStack(0x12, fileNumber);
 }
 
-void DFRobotDFPlayerMini::advertise(int fileNumber){
-  sendStack(0x13, fileNumber);
+uint8_t DFRobotDFPlayerMini::advertise(int fileNumber){
+  return sendStack(0x13, fileNumber);
 }
 
-void DFRobotDFPlayerMini::playLargeFolder(uint8_t folderNumber, uint16_t fileNumber){
-  sendStack(0x14, (((uint16_t)folderNumber) << 12) | fileNumber);
+uint8_t DFRobotDFPlayerMini::playLargeFolder(uint8_t folderNumber, uint16_t fileNumber){
+  return sendStack(0x14, (((uint16_t)folderNumber) << 12) | fileNumber);
 }
 
-void DFRobotDFPlayerMini::stopAdvertise(){
-  sendStack(0x15);
+uint8_t DFRobotDFPlayerMini::stopAdvertise(){
+  return sendFrame(FRAME_STOP_ADVERTISE);
 }
 
-void DFRobotDFPlayerMini::stop(){
-  sendStack(0x16);
+uint8_t DFRobotDFPlayerMini::stop(){
+  return sendFrame(FRAME_STOP);
 }
 
-void DFRobotDFPlayerMini::loopFolder(int folderNumber){
-  sendStack(0x17, folderNumber);
+uint8_t DFRobotDFPlayerMini::loopFolder(int folderNumber){
+  return sendStack(0x17, folderNumber);
 }
 
-void DFRobotDFPlayerMini::randomAll(){
-  sendStack(0x18);
+uint8_t DFRobotDFPlayerMini::randomAll(){
+  return sendFrame(FRAME_RANDOM_ALL);
 }
 
-void DFRobotDFPlayerMini::enableLoop(){
-  sendStack(0x19, 0x00);
+uint8_t DFRobotDFPlayerMini::enableLoop(){
+  return setState(0x19, 0x00, 0, FRAME_ENABLE_LOOP);
 }
 
-void DFRobotDFPlayerMini::disableLoop(){
-  sendStack(0x19, 0x01);
+uint8_t DFRobotDFPlayerMini::disableLoop(){
+  return setState(0x19, 0x01, 0, FRAME_DISABLE_LOOP);
 }
 
-void DFRobotDFPlayerMini::enableDAC(){
-  sendStack(0x1A, 0x00);
+uint8_t DFRobotDFPlayerMini::enableDAC(){
+  return sendFrame(FRAME_ENABLE_DAC);
 }
 
-void DFRobotDFPlayerMini::disableDAC(){
-  sendStack(0x1A, 0x01);
+uint8_t DFRobotDFPlayerMini::disableDAC(){
+  return sendFrame(FRAME_DISABLE_DAC);
 }
 
-int DFRobotDFPlayerMini::readState(){
-  sendStack(0x42);
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
-  }
+uint8_t DFRobotDFPlayerMini::queryState(){
+  return query(0x42);
 }
 
-int DFRobotDFPlayerMini::readVolume(){
-  sendStack(0x43);
-  if (waitAvailable()) {
-    return read();
-  }
-  else{
-    return -1;
-  }
+uint8_t DFRobotDFPlayerMini::queryVolume(){
+  return query(0x43);
 }
 
-int DFRobotDFPlayerMini::readEQ(){
-  sendStack(0x44);
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
-  }
+uint8_t DFRobotDFPlayerMini::queryEQ(){
+  return query(0x44);
 }
 
-int DFRobotDFPlayerMini::readFileCounts(uint8_t device){
+uint8_t DFRobotDFPlayerMini::queryFileCounts(uint8_t device){
   switch (device) {
     case DFPLAYER_DEVICE_U_DISK:
-      sendStack(0x47);
-      break;
+      return query(0x47);
     case DFPLAYER_DEVICE_SD:
-      sendStack(0x48);
-      break;
+      return query(0x48);
     case DFPLAYER_DEVICE_FLASH:
-      sendStack(0x49);
-      break;
+      return query(0x49);
     default:
-      break;
-  }
-  
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
+      return DFPLAYER_NO_HANDLE;
   }
 }
 
-int DFRobotDFPlayerMini::readCurrentFileNumber(uint8_t device){
+uint8_t DFRobotDFPlayerMini::queryCurrentFileNumber(uint8_t device){
   switch (device) {
     case DFPLAYER_DEVICE_U_DISK:
-      sendStack(0x4B);
-      break;
+      return query(0x4B);
     case DFPLAYER_DEVICE_SD:
-      sendStack(0x4C);
-      break;
+      return query(0x4C);
     case DFPLAYER_DEVICE_FLASH:
-      sendStack(0x4D);
-      break;
+      return query(0x4D);
     default:
-      break;
-  }
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
+      return DFPLAYER_NO_HANDLE;
   }
 }
 
+uint8_t DFRobotDFPlayerMini::queryFileCountsInFolder(int folderNumber){
+  return query(0x4E, folderNumber);
+}
+
+uint8_t DFRobotDFPlayerMini::queryFolderCounts(){
+  return query(0x4F);
+}
+
+int DFRobotDFPlayerMini::readState(){
+  return waitQuery(queryState());
+}
+
+int DFRobotDFPlayerMini::readVolume(){
+  return waitQuery(queryVolume());
+}
+
+int DFRobotDFPlayerMini::readEQ(){
+  return waitQuery(queryEQ());
+}
+
+int DFRobotDFPlayerMini::readFileCounts(uint8_t device){
+  return waitQuery(queryFileCounts(device));
+}
+
+int DFRobotDFPlayerMini::readCurrentFileNumber(uint8_t device){
+  return waitQuery(queryCurrentFileNumber(device));
+}
+
 int DFRobotDFPlayerMini::readFileCountsInFolder(int folderNumber){
-  sendStack(0x4E, folderNumber);
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
-  }
+  return waitQuery(queryFileCountsInFolder(folderNumber));
 }
 
 int DFRobotDFPlayerMini::readFolderCounts(){
-  sendStack(0x4F);
-  if (waitAvailable()) {
-    if (readType() == DFPlayerFeedBack) {
-      return read();
-    }
-    else{
-      return -1;
-    }
-  }
-  else{
-    return -1;
-  }
+  return waitQuery(queryFolderCounts());
 }
 
 int DFRobotDFPlayerMini::readFileCounts(){
@@ -530,5 +1118,3 @@ int DFRobotDFPlayerMini::readFileCounts(){
 int DFRobotDFPlayerMini::readCurrentFileNumber(){
   return readCurrentFileNumber(DFPLAYER_DEVICE_SD);
 }
-
-
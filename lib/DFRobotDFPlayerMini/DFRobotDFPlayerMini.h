@@ -33,6 +33,10 @@
 #define DFPLAYER_RECEIVED_LENGTH 10
 #define DFPLAYER_SEND_LENGTH 10
 
+#ifndef DFPLAYER_MESSAGE_LENGTH
+#define DFPLAYER_MESSAGE_LENGTH 8   //received messages ring length (must be a power of 2)
+#endif
+
 //#define _DEBUG
 
 #define TimeOut 0
@@ -65,21 +69,180 @@
 #define Stack_CheckSum 7
 #define Stack_End 9
 
+#define DFPLAYER_QUEUE_LENGTH 8     //command queue length (frames)
+#define DFPLAYER_PENDING_LENGTH 4   //sent queries waiting for their reply out of the queue
+#define DFPLAYER_RETRANSMIT 2       //how many times an unacknowledged frame is sent again
+#define DFPLAYER_ACK_TIMEOUT 100    //time in ms to wait for the ACK (0x41) of the sent frame
+#define DFPLAYER_FRAME_GAP 10       //time in ms between two frames if the ack mode is off
+
+#define DFPLAYER_CACHE_LENGTH 10    //cached query results (file and folder counts - all nine folders and the card)
+#define DFPLAYER_EVENT_LENGTH 4     //unsolicited events (play finished, card removed...) waiting to be read
+
+#define DFPLAYER_NO_HANDLE 0        //command was not queued (the queue is full)
+#define DFPLAYER_SET_HANDLE 0xFF    //setting was not sent - the player is already set (always DFPLAYER_COMMAND_DONE)
+#define DFPLAYER_NO_FRAME 0xFF      //queued command has no constant frame in flash
+#define DFPLAYER_STATE_UNKNOWN 0xFF //shadow value is not known, the next setting is always sent
+
+#define DFPLAYER_COMMAND_DONE 0     //command was sent and acknowledged (or sent if the ack mode is off), query was answered
+#define DFPLAYER_COMMAND_QUEUED 1   //command waits in the queue
+#define DFPLAYER_COMMAND_SENT 2     //command was sent, waiting for the ACK (query also for its reply)
+#define DFPLAYER_COMMAND_FAILED 3   //command was not acknowledged (query not answered) after all retransmissions - timeout
+#define DFPLAYER_COMMAND_ERROR 4    //player answered the command with an error (0x40)
+#define DFPLAYER_COMMAND_UNKNOWN 5  //handle is not valid anymore (the queue slot was reused)
+
+#define DFPLAYER_LATENCY_BUCKETS 10 //latency histogram: bucket n counts 2^n - 2^(n+1)-1 ms (0 ms in bucket 0), the last one also longer times
+
+// protocol health counters (saturate at 0xFFFF)
+struct DFPlayerStats {
+  uint16_t framesSent;        //frames written to the player (retransmissions included)
+  uint16_t framesReceived;    //valid frames received from the player
+  uint16_t retransmits;       //frames sent again (no ACK, damaged frame reported by the player)
+  uint16_t headerErrors;      //wrong version byte (0xFF)
+  uint16_t lengthErrors;      //wrong length byte (0x06)
+  uint16_t endErrors;         //wrong end byte (0xEF)
+  uint16_t checkSumErrors;    //checksum mismatch
+  uint16_t resyncs;           //damaged frames followed by a frame found in the already received bytes
+  uint16_t overruns;          //received messages lost - the ring was full
+  uint16_t ackTimeouts;       //ACK not received in DFPLAYER_ACK_TIMEOUT
+  uint16_t queryTimeouts;     //query not answered in the timeout
+  uint16_t timeOuts;          //waitAvailable() timeouts
+  uint16_t playerErrors;      //errors (0x40) reported by the player
+  uint16_t ackLatency[DFPLAYER_LATENCY_BUCKETS];   //time from sending to the ACK
+  uint16_t queryLatency[DFPLAYER_LATENCY_BUCKETS]; //time from sending the query to its reply
+};
+
+// complete frame sent to the player
+struct DFPlayerFrame {
+  uint8_t bytes[DFPLAYER_SEND_LENGTH];
+};
+
+constexpr uint16_t dfplayerCheckSum(uint8_t command, uint16_t parameter, uint8_t ack){
+  return (uint16_t)(0 - (0xFF + 0x06 + command + ack + (parameter >> 8) + (parameter & 0xFF)));
+}
+
+// frame with the checksum built at compile time (stored in flash for the constant commands)
+constexpr DFPlayerFrame dfplayerFrame(uint8_t command, uint16_t parameter = 0, uint8_t ack = 0x01){
+  return {{0x7E, 0xFF, 0x06, command, ack, (uint8_t)(parameter >> 8), (uint8_t)parameter,
+           (uint8_t)(dfplayerCheckSum(command, parameter, ack) >> 8), (uint8_t)dfplayerCheckSum(command, parameter, ack), 0xEF}};
+}
+
 class DFRobotDFPlayerMini {
-  Stream* _serial;
+  // serial transport: a Stream, or the transport of DFPlayerDriver<Transport> called without virtual calls
+  void *_port = nullptr;
+  int (*_readByte)(void *port);                         //returns the received byte, -1 - nothing received
+  void (*_writeFrame)(void *port, const uint8_t *frame); //writes DFPLAYER_SEND_LENGTH bytes
+  
+  static int streamRead(void *port);
+  static void streamWrite(void *port, const uint8_t *frame);
   
   unsigned long _timeOutTimer;
   unsigned long _timeOutDuration = 500;
   
   uint8_t _received[DFPLAYER_RECEIVED_LENGTH];
-  uint8_t _sending[DFPLAYER_SEND_LENGTH] = {0x7E, 0xFF, 06, 00, 01, 00, 00, 00, 00, 0xEF};
+  bool _isACK = true;       //the sent frames request the 0x41 ack feedback
   
   uint8_t _receivedIndex=0;
+  uint16_t _receivedSum=0;  //checksum of the received frame, calculated byte by byte
+
+  // one validated frame received from the player
+  struct Message {
+    uint8_t command;    //command byte, 0x00 - wrong frame
+    uint16_t parameter; //parameter
+  };
+
+  // ring of received messages: receiveByte() writes to the tail, available() reads from the head
+  Message _messages[DFPLAYER_MESSAGE_LENGTH];
+  volatile uint8_t _messageHead = 0;
+  volatile uint8_t _messageTail = 0;
+
+  void pushMessage(uint8_t command, uint16_t parameter);
+  bool checkByte(uint8_t index, uint8_t data);
+  void resync();
+
+  DFPlayerStats _stats = {}; //kept over begin(), cleared by clearStats()
+
+  static void count(uint16_t &counter);
+  static void countLatency(uint16_t *histogram, uint16_t duration);
+
+  // one queued command frame
+  struct Command {
+    uint8_t handle;     //handle returned to the caller
+    uint8_t command;    //command byte
+    uint16_t parameter; //parameter
+    uint8_t status;     //DFPLAYER_COMMAND_*
+    uint8_t retries;    //number of retransmissions
+    uint8_t gap;        //minimal time in ms before the next frame
+    uint8_t frame;      //index of the constant frame in flash, DFPLAYER_NO_FRAME - built from command and parameter
+    uint16_t sent;      //time of sending (query reply timeout)
+  };
+
+  Command _queue[DFPLAYER_QUEUE_LENGTH] = {};
+  Command _pending[DFPLAYER_PENDING_LENGTH] = {}; //sent queries waiting for the reply, their queue slots are free
+  uint8_t _queueHead = 0;   //first command in the queue (in progress)
+  uint8_t _queueCount = 0;  //commands waiting in the queue
+  uint8_t _lastHandle = DFPLAYER_NO_HANDLE;
+  uint8_t _sendGap = 0;     //time in ms the next frame must wait after the last one
+
+  // cached result of the query, valid until the card is changed
+  struct CacheEntry {
+    uint8_t command;    //query command, 0x00 - free entry
+    uint8_t parameter;  //query parameter (folder number)
+    uint16_t value;     //result
+    uint8_t handle;     //handle of the query, returned to every lookup of the entry
+  };
+
+  CacheEntry _cache[DFPLAYER_CACHE_LENGTH] = {};
+  uint8_t _cacheNext = 0;   //entry replaced by the next result
+
+  // shadow of the last confirmed player settings, DFPLAYER_STATE_UNKNOWN - not known
+  uint8_t _volume = DFPLAYER_STATE_UNKNOWN;
+  uint8_t _eq = DFPLAYER_STATE_UNKNOWN;
+  uint8_t _device = DFPLAYER_STATE_UNKNOWN;
+  uint8_t _loop = DFPLAYER_STATE_UNKNOWN;     //single loop (0x19) parameter
+
+  void buildStack(uint8_t *frame, const Command *slot);
+  void sendStack(const uint8_t *frame);
+  uint8_t sendFrame(uint8_t frame);
+  uint8_t sendStack(uint8_t command);
+  uint8_t sendStack(uint8_t command, uint16_t argument);
+  uint8_t sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow);
+
+  uint8_t enqueue(uint8_t command, uint16_t argument, uint8_t gap, uint8_t frame = DFPLAYER_NO_FRAME);
+
+  uint8_t setState(uint8_t command, uint16_t argument, uint8_t gap = 0, uint8_t frame = DFPLAYER_NO_FRAME);
+  uint8_t* stateOf(uint8_t command);
+  void updateState(uint8_t command, uint16_t parameter, uint8_t status);
+
+  // unsolicited event reported by available() / readType() / read()
+  struct Event {
+    uint8_t type;       //DFPlayerPlayFinished, DFPlayerCardRemoved...
+    uint16_t parameter; //parameter
+  };
+
+  Event _events[DFPLAYER_EVENT_LENGTH] = {};
+  uint8_t _eventHead = 0;
+  uint8_t _eventCount = 0;
+
+  void pushEvent(uint8_t type, uint16_t parameter = 0);
 
-  void sendStack();
-  void sendStack(uint8_t command);
-  void sendStack(uint8_t command, uint16_t argument);
-  void sendStack(uint8_t command, uint8_t argumentHigh, uint8_t argumentLow);
+  void nextCommand();
+  void pendQuery(Command *slot);
+  Command* findHandle(uint8_t handle);
+  void completeCommand(uint8_t status);
+  Command* findQuery(uint8_t command);
+  
+  static bool isQuery(uint8_t command);
+  
+  static bool isCacheable(uint8_t command);
+  
+  static bool keepsLoop(uint8_t command);
+  
+  void storeCache(uint8_t command, uint16_t parameter, uint16_t value, uint8_t handle);
+  
+  uint8_t nextHandle();
+  bool isHandleUsed(uint8_t handle);
+  
+  int waitQuery(uint8_t handle);
 
   void enableACK();
   void disableACK();
@@ -88,15 +251,16 @@ class DFRobotDFPlayerMini {
   
   uint16_t arrayToUint16(uint8_t *array);
   
-  uint16_t calculateCheckSum(uint8_t *buffer);
-  
 
 
-  void parseStack();
-  bool validateStack();
+  void parseStack(uint8_t command, uint16_t parameter);
   
   uint8_t device = DFPLAYER_DEVICE_SD;
   
+  protected:
+  
+  bool begin(void *port, int (*readByte)(void *port), void (*writeFrame)(void *port, const uint8_t *frame), bool isACK, bool doReset);
+  
   public:
   
   uint8_t _handleType;
@@ -104,6 +268,7 @@ class DFRobotDFPlayerMini {
   uint16_t _handleParameter;
   bool _isAvailable = false;
   bool _isSending = false;
+  uint8_t _sentCommand = 0x00; //command of the last sent frame
   
   bool handleMessage(uint8_t type, uint16_t parameter = 0);
   bool handleError(uint8_t type, uint16_t parameter = 0);
@@ -116,67 +281,109 @@ class DFRobotDFPlayerMini {
   
   bool available();
   
+  bool update();
+  
+  void receiveByte(uint8_t data);
+  
+  uint8_t receivedLength();
+  
+  void poll();
+  
+  bool waitIdle(unsigned long duration = 0);
+  
+  bool isIdle();
+  
+  uint8_t commandStatus(uint8_t handle);
+  
+  bool commandDone(uint8_t handle);
+  
+  uint8_t query(uint8_t command, uint16_t parameter = 0);
+  
+  int queryValue(uint8_t handle);
+  
+  void clearCache();
+  
+  void clearState();
+  
+  DFPlayerStats stats();
+  
+  void clearStats();
+  
   uint8_t readType();
   
   uint16_t read();
   
   void setTimeOut(unsigned long timeOutDuration);
   
-  void next();
+  uint8_t next();
+  
+  uint8_t previous();
+  
+  uint8_t play(int fileNumber=1);
+  
+  uint8_t volumeUp();
+  
+  uint8_t volumeDown();
+  
+  uint8_t volume(uint8_t volume);
+  
+  uint8_t EQ(uint8_t eq);
+  
+  uint8_t loop(int fileNumber);
   
-  void previous();
+  uint8_t outputDevice(uint8_t device);
   
-  void play(int fileNumber=1);
+  uint8_t sleep();
   
-  void volumeUp();
+  uint8_t reset();
   
-  void volumeDown();
+  uint8_t start();
   
-  void volume(uint8_t volume);
+  uint8_t pause();
   
-  void EQ(uint8_t eq);
+  uint8_t playFolder(uint8_t folderNumber, uint8_t fileNumber);
   
-  void loop(int fileNumber);
+  uint8_t outputSetting(bool enable, uint8_t gain);
   
-  void outputDevice(uint8_t device);
+  uint8_t enableLoopAll();
   
-  void sleep();
+  uint8_t disableLoopAll();
   
-  void reset();
+  uint8_t playMp3Folder(int fileNumber);
   
-  void start();
+  uint8_t advertise(int fileNumber);
   
-  void pause();
+  uint8_t playLargeFolder(uint8_t folderNumber, uint16_t fileNumber);
   
-  void playFolder(uint8_t folderNumber, uint8_t fileNumber);
+  uint8_t stopAdvertise();
   
-  void outputSetting(bool enable, uint8_t gain);
+  uint8_t stop();
   
-  void enableLoopAll();
+  uint8_t loopFolder(int folderNumber);
   
-  void disableLoopAll();
+  uint8_t randomAll();
   
-  void playMp3Folder(int fileNumber);
+  uint8_t enableLoop();
   
-  void advertise(int fileNumber);
+  uint8_t disableLoop();
   
-  void playLargeFolder(uint8_t folderNumber, uint16_t fileNumber);
+  uint8_t enableDAC();
   
-  void stopAdvertise();
+  uint8_t disableDAC();
   
-  void stop();
+  uint8_t queryState();
   
-  void loopFolder(int folderNumber);
+  uint8_t queryVolume();
   
-  void randomAll();
+  uint8_t queryEQ();
   
-  void enableLoop();
+  uint8_t queryFileCounts(uint8_t device);
   
-  void disableLoop();
+  uint8_t queryCurrentFileNumber(uint8_t device);
   
-  void enableDAC();
+  uint8_t queryFileCountsInFolder(int folderNumber);
   
-  void disableDAC();
+  uint8_t queryFolderCounts();
   
   int readState();
   
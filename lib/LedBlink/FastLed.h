@@ -0,0 +1,62 @@
+/*
+ * Library LedBlink
+ *
+ * LedBlink with the pin known at compile time.
+ *
+ * file   : FastLed.h
+ *
+ *   LedBlink writes the pin by digitalWrite(_pin) - the port and the bit mask are looked up
+ *   in the tables of the core on every call. FastLed<PIN> writes it by digitalWriteFast(PIN),
+ *   which the core resolves at compile time to one sbi / cbi on the VPORT register.
+ *   The blinking sequences are the same. LedBlink stays for pins known at run time.
+ *
+ *   Usage:
+ *          FastLed<PIN_PA4> led;
+ *
+ *          led.begin(OFF);             // in setup()
+ *          led.blink(pattern);
+ *          led.update();               // in loop()
+ */
+
+#ifndef _FASTLED_H_
+#define _FASTLED_H_
+
+#include "Arduino.h"
+#include "LedBlink.h"
+
+template <uint8_t PIN>
+class FastLed : public LedBlink {
+public:
+
+  // initializing
+  void begin(int initial_state = OFF) {
+    LedBlink::begin(PIN, initial_state);
+  }
+
+  // turn LED on
+  inline void on() {
+    digitalWriteFast(PIN, HIGH);
+    _ledState = ON;
+  }
+
+  // turn LED off
+  inline void off() {
+    digitalWriteFast(PIN, LOW);
+    _ledState = OFF;
+  }
+
+  // Stop blink
+  void stop(int state = OFF) {
+    isBlinking = false;
+    if (state == ON) on(); else off();
+  }
+
+  // Update blink, must by called periodicaly
+  void update() {
+    int state = next();
+    if (state == ON) digitalWriteFast(PIN, HIGH);
+    else if (state == OFF) digitalWriteFast(PIN, LOW);
+  }
+};
+
+#endif
@@ -98,11 +98,18 @@ void LedBlink::stop(int state) {
   }
 
 void LedBlink::update() {
-  if (!isBlinking) return;  // not blinking yet
+  int state = next();
+  if (state == ON) digitalWrite(_pin, HIGH);
+  else if (state == OFF) digitalWrite(_pin, LOW);
+}
+
+int LedBlink::next() {
+  int previous = _ledState;
+  if (!isBlinking) return LED_BLINK_NO_CHANGE;  // not blinking yet
   if (_mode == 2) {
     if (millis() - _startTimer > _timeTime) {
       isBlinking = false;
-      off();
+      _ledState = OFF;
     }
   }
   if (millis() - _timer > _time) {
@@ -115,7 +122,7 @@ void LedBlink::update() {
         case 1:                // REPEAT x Times
           if (_repeat <= 1) {  // end of repeat
             isBlinking = false;
-            return;
+            return (_ledState == previous) ? LED_BLINK_NO_CHANGE : _ledState;
           } else {
             _repeat--;
             _index = 1;  // start command sequence
@@ -132,18 +139,19 @@ void LedBlink::update() {
         case 0:
         
         default:
-          if (_ledState == OFF) on();
-          else off();  // update LED lighting -toggle
+          if (_ledState == OFF) _ledState = ON;
+          else _ledState = OFF;  // update LED lighting -toggle
 
           isBlinking = false;
-          return;
+          return _ledState;
       }
     }
 
-    if (_ledState == OFF) on();
-    else off();  // update LED lighting -toggle
+    if (_ledState == OFF) _ledState = ON;
+    else _ledState = OFF;  // update LED lighting -toggle
 
     _timer = millis();
     _time = _ca[_index] * _tickTime;
   }
+  return (_ledState == previous) ? LED_BLINK_NO_CHANGE : _ledState;
 }
\ No newline at end of file
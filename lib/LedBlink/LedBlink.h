@@ -51,6 +51,8 @@
 #define LED_BLINK_TIME_MODE       0x8000u   // play flashing sequence repeatedly for setted time
 #define LED_BLINK_INFINITY_MODE   0xC000u   // play flashing sequence repeatedly indefinitely
 
+#define LED_BLINK_NO_CHANGE       -1        // next(): the LED is not switched
+
 class LedBlink {
 public:
 
@@ -93,6 +95,10 @@ public:
   void stop(int state = OFF); 
 
 protected:
+  // Advance the blinking sequence without writing the pin
+  // returns the new LED state ON | OFF to be written, or LED_BLINK_NO_CHANGE
+  int next();
+
   int _pin;       // GPIO pin#
   int _ledState;  // LED state - ON | OFF
   int _index;     // command array item actual index
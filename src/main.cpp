@@ -12,15 +12,47 @@
 // Buttons debouncing and button events library
 #include "Button.h"
 
+// Buttons with compile-time timings and only the detectors in use
+#include "PolicyButton.h"
+
+// Gong input for DC, AC (50/60 Hz pulses) and contact signals
+#include "GongInput.h"
+
+// Debouncing of all buttons in one pass (vertical counters over VPORTA / VPORTB)
+#include "ButtonBank.h"
+
+// Chords and combos of the buttons declared in a table in flash
+#include "ButtonChord.h"
+
 // Library for controlling LED blinking
 #include "LedBlink.h"
 
+// LED blinking on a pin known at compile time (sbi / cbi instead of digitalWrite)
+#include "FastLed.h"
+
 // DFPlayer Mini Library
 #include "DFRobotDFPlayerMini.h"
 
+// Interrupt driven serial port for DFPlayer Mini (replaces Serial1)
+#include "DFPlayerUsart.h"
+
+// DFPlayer driver bound to DFPlayerUsart at compile time (no virtual calls in the polling)
+#include "DFPlayerDriver.h"
+
+// BUSY pin of the player known at compile time (sbis instead of digitalRead)
+#include "DFPlayerBusy.h"
+
 // Debug statements to the serial interface
 #define DEBUG_ON
 
+// Large ringtone library: files 0001.mp3 - 3000.mp3 in the folders (played by playLargeFolder),
+// otherwise 001.mp3 - 255.mp3 (played by playFolder)
+//#define LARGE_LIBRARY
+
+// UI messages over a playing ringtone preview are inserted by advertise() - the preview continues
+// after them. The messages must also be in the ADVERT folder: ADVERT/0020.mp3 = 51/020.mp3 etc.
+#define ADVERT_PROMPTS
+
 
 // I/O PINS
 
@@ -33,6 +65,12 @@
     #define PIN_BTN_MENU        PIN_PA6
     #define PIN_BTN_STOP        PIN_PA7
 
+    // bits of the buttons in the ButtonBank (chord table)
+    #define BANK_BTN_PREVIOUS   BUTTON_BANK_PB(0)  // PIN_BTN_PREVIOUS
+    #define BANK_BTN_NEXT       BUTTON_BANK_PB(1)  // PIN_BTN_NEXT
+    #define BANK_BTN_MENU       BUTTON_BANK_PA(6)  // PIN_BTN_MENU
+    #define BANK_BTN_STOP       BUTTON_BANK_PA(7)  // PIN_BTN_STOP
+
 // Playmodes
 
     #define MODE_ONE    0  // Play a single ringtone
@@ -49,6 +87,8 @@
     #define PLAYER_OTHER_ERROR    5 // Other Players error
     #define PLAYER_CARD_INSERTED  6
     #define PLAYER_CARD_REMOVED   7
+    #define PLAYER_FINISHED       8 // Track finished (0x3D frame)
+    #define PLAYER_ADVERT_ERROR   9 // advertise() failed - nothing is playing
 
 // Status
 
@@ -100,6 +140,48 @@
     #define MESSAGE_RESET_BELL              140 // "Bol vykonaný reset zvončeka"
     #define MESSAGE_DEFAULT_GONG            255 // "Predvolené zvonenie - použije sa ak požadované zvonenie nie je k dispozícii"
 
+// Zones - players ringing together with the doorbell player (zone 0 is myDFPlayer)
+
+    #define ZONES                 1     // count of zones; 2 - second player on USART0 (PB2 TxD, PB3 RxD), DEBUG_ON must be off
+    #define ZONE_NO_BUSY       0xFF     // the player of the zone has no BUSY pin - the ring is measured to the ACK
+    #define ZONE_RING_TIMEOUT  2000     // the zone not playing in this time after the ring is counted as failed
+
+    #define ZONE2_FOLDER          1     // ringtone of the zone 2
+    #define ZONE2_FILE            1
+    #define ZONE2_VOLUME         20
+
+#if (ZONES > 1) && defined(DEBUG_ON)
+    #error "The zone 2 player uses the debug serial port (USART0) - turn DEBUG_ON off"
+#endif
+
+// Ringtone library
+
+    #define FOLDER_FIRST          1   // first ringtone folder
+    #define FOLDER_LAST           9   // last ringtone folder (messages MESSAGE_FOLDER_1 - MESSAGE_FOLDER_9)
+#ifdef LARGE_LIBRARY
+    #define FILE_LAST          3000   // highest file number in a folder (0001.mp3 - 3000.mp3)
+#else
+    #define FILE_LAST           255   // highest file number in a folder (001.mp3 - 255.mp3)
+#endif
+
+// Player power
+
+    #define POWER_ON              0 // player is awake
+    #define POWER_SLEEP           1 // player sleeps, DAC is off
+    #define POWER_WAKING          2 // wake sequence sent, waiting for the first sound (BUSY ON)
+
+    #define IDLE_SLEEP_TIME   60000ul // quiet period before the player is put to sleep (1 min.), 0 - never
+    #define WAKE_TIMEOUT       1500   // maximum time from the wake to the first sound, then the player is reset
+
+// Prompts
+
+    #define ADVERT_ERROR_TIME   300   // an error of the player in this time after advertise() belongs to it
+
+// Playlist
+
+    #define PLAYLIST_LENGTH       4   // clips waiting to be played after the current one
+    #define PLAYLIST_END_GUARD  200   // time after the start of a clip, in which an end signal belongs to the previous clip
+
 // Blink status
 
     #define BLINK_IDLE                  0
@@ -107,6 +189,7 @@
     #define BLINK_PLAY                  2
     #define BLINK_MISSING_DEFAULT_GONG  3
     #define BLINK_GENERAL_ERROR         4
+    #define BLINK_PLAYER_ERROR          5
 
 
 // Other
@@ -115,9 +198,26 @@
     #define VOLUME_STEP           5   // volume increase/decrease step (1-30)
     #define VOLUME_MIN           10   // minimum  volume (0-30)
     #define VOLUME_MAX           30   // maximum volume (0-30) 
+    #define VOLUME_REPEAT_DELAY 600   // holding time of M + < / M + > before the volume auto-repeat
+    #define VOLUME_REPEAT_TIME  150   // volume auto-repeat period
+    #define VOLUME_REPEAT_STEP    1   // volume step of the auto-repeat (fine setting)
+    #define VOLUME_PROMPT_DELAY 1000  // the volume message is played this time after the last change (if nothing is playing), 0 - never
     #define RESET_TIME        10000   // the time required to press the buttons to trigger the doorbell reset (10 sec.)
     #define LOCK_BUTTONS_TIME  3000   // time interval for automatic unlocking of buttons (3 sec.)
     #define EDIT_TIME         20000ul // duration of editing mode (20 sec.)
+    #define STOP_TIMEOUT        500   // BUSY OFF later than this after stop is the end of playback (0.5 sec.)
+
+// Player recovery
+
+    #define PLAYER_ONLINE         0 // player answers
+    #define PLAYER_RESETTING      1 // reset sent, waiting for the card online message
+    #define PLAYER_SETTLING       2 // player answered, waiting for its initialization
+    #define PLAYER_BACKOFF        3 // player did not answer, waiting for the next attempt
+
+    #define RECOVERY_RESET_TIME  2000   // waiting time for the answer to the reset (2 sec.)
+    #define RECOVERY_SETTLE_TIME  200   // player initialization time after the answer
+    #define RECOVERY_BACKOFF_MIN  500   // pause after the first failed attempt
+    #define RECOVERY_BACKOFF_MAX 16000  // maximum pause between attempts (doubled after each attempt)
 
 
 #ifdef DEBUG_ON
@@ -135,7 +235,7 @@
 
 // LedBlink patterns
   const unsigned int blink_start[] = {LED_BLINK_REPEAT_MODE | 5, 100, 100, 100, 100, 100, 500, 0};
-  const unsigned int blink_player_error[] = {LED_BLINK_TIME_MODE | 2000, 20, 20, 0};
+  const unsigned int blink_player_error[] = {LED_BLINK_INFINITY_MODE, 20, 20, 0};
   const unsigned int blink_edit[] = {LED_BLINK_INFINITY_MODE, 1000, 50, 0};
   const unsigned int blink_idle[] = {LED_BLINK_INFINITY_MODE, 100, 5000, 0};
   const unsigned int blink_gong[] = {LED_BLINK_INFINITY_MODE, 200, 200, 0};
@@ -146,7 +246,7 @@
 
 struct GongSettings {
     uint8_t folder; //folder number 01-09
-    uint8_t file;   //file 001-255
+    uint16_t file;  //file 001-255 (0001-3000 if LARGE_LIBRARY)
     uint8_t mode;   //playmode MODE_ONE | MODE_RANDOM | MODE_NEXT
     uint8_t volume; //volume 0-30
     bool first;     //first file in folder - "left margin"
@@ -154,6 +254,32 @@ struct GongSettings {
     bool ready;     //file ready (doesn't generate new file number)  
 };
 
+// zone - player with its own BUSY pin and ringtone
+
+struct Zone {
+    DFRobotDFPlayerMini *player;   //player of the zone (commands are queued - the zones interleave)
+    uint8_t pin_busy;              //BUSY pin, ZONE_NO_BUSY - none
+    volatile uint8_t *busy_in;     //input register of the BUSY pin (set in init_hardware())
+    uint8_t busy_mask;             //bit of the BUSY pin
+    struct GongSettings *settings; //ringtone of the zone (zone 0 - gong[NORMAL])
+    uint8_t play_handle;           //handle of the play command, DFPLAYER_NO_HANDLE - not sent yet
+    bool ringing;                  //the ring latency is being measured
+    unsigned int ring_time;        //time of the ring
+    unsigned int latency;          //last time from the ring to the first sound (ACK without BUSY pin) in ms
+    unsigned int latency_max;      //longest time from the ring to the first sound in ms
+    uint16_t rings;                //measured rings
+    uint16_t failures;             //rings not played (command failed or error)
+};
+
+
+// clip of the playlist
+
+struct Clip {
+    uint8_t folder;  //folder number
+    uint16_t file;   //file number
+    uint8_t status;  //status while the clip is playing STATUS_*
+};
+
 
 // Timer structure
 
@@ -208,20 +334,38 @@ struct Timer {
   void volumeDownAction();
   void nextPlayModeAction();
   void saveAction();
+  void resetAction();
+
+// Prototypes of chord actions (ButtonChords), repeat - auto-repeat while the chord is held
+
+  void resetChord(bool repeat);
+  void testChord(bool repeat);
+  void volumeUpChord(bool repeat);
+  void volumeDownChord(bool repeat);
 
 // Prototypes other function
 
   void stop(); //stop playing
-  void play(uint8_t folder , uint8_t file); //play file/folder
+  void prompt(uint8_t message); //plays the UI message, over a preview by advertise()
+  bool advertFailed(bool file_error); //the inserted message failed - plays it normally
+  void play(uint8_t folder , uint16_t file); //play file/folder
+  void startClip(uint8_t folder, uint16_t file); //sends the play command without stop
+  bool queueClip(uint8_t folder, uint16_t file, uint8_t clip_status = STATUS_MESSAGE); //plays the clip after the current one
+  void clearPlaylist(); //removes the waiting clips
+  bool nextClip(); //the clip ended - starts the next one
   void prevFile(); // set previous file in current folder
   void nextFile(); // set next file in current folder
   void prevFolder(); // set previous folder and file set to 1
   void nextFolder(); // set next folder and file set to 1
   void volumeUp(); //volume up
   void volumeDown(); //volume down
-  void tryReset(); // wait 10sec and then reset
+  void volumeStep(int step); //changes the volume of the playing sound
+  void volumePrompt(); //deferred volume message
   void init_gong(); // initialize gong structure
-  void init_general(); // general initialize
+  void init_hardware(); // pins, serial ports, buttons - once in setup()
+  void init_general(); // general initialize: player, gong structure
+  void init_doorbell(); // general initialize + settings from EEPROM
+  void buttonEvents(); // delivers the button events from the timer interrupt
   void unblockLockedButtons();
   void blink(int status);
   bool load(); // loads settings from EEPROM
@@ -232,25 +376,62 @@ struct Timer {
   int  edgeBusy(bool reset = true); // returns BUSY edge: to LOW 1, to HIGH -1, no change 0
   void playerUpdate(); // updates player; call regularly
   int  playerEvent();  // gets player event
-  int  getFileCountsInFolder(uint8_t folder); // get file counts in folder
+  int  fileCount(uint8_t folder); // file counts in folder without waiting; -1 - not known yet
+  void startRecovery(); // starts the player initialization in the background
+  void resetPlayer(); // one attempt of the player initialization
+  bool playerRecovery(); // recovery state machine; returns true if the player is online
+  void playerOnline(); // the player is back: start message, pending ring
+  void playRandom(); // plays random ringtone when the player answers the file counts query
+  void fileErrorCount(); // finishes the file error of next / previous file when the player answers the file counts query
+  void ringZones(); // rings the other zones, starts the latency measurement in all zones
+  void updateZones(); // updates the players of the other zones, measures the ring latency
+  void idlePower(); // puts the idle player to sleep, bounds the wake time
+  void wakePlayer(); // wakes the sleeping player (no stop before the next play)
 
 // Debug print functions
   void printEvent(int event);
   void printStatus(int status);
+  void printPlayerStats();
+  void printButtonCosts();
 
   
 // Button instances
-  RealButton btnPrev(PIN_BTN_PREVIOUS);
-  RealButton btnNext(PIN_BTN_NEXT);
-  RealButton btnMode(PIN_BTN_MENU);
-  RealButton btnStop(PIN_BTN_STOP);
-  RealButton btnGong(PIN_GONG);
+  PolicyButton<ButtonClickPolicy> btnPrev(PIN_BTN_PREVIOUS);  // onClick, onLong
+  PolicyButton<ButtonClickPolicy> btnNext(PIN_BTN_NEXT);
+  PolicyButton<ButtonClickPolicy> btnMode(PIN_BTN_MENU);
+  PolicyButton<ButtonClickPolicy> btnStop(PIN_BTN_STOP);
+  GongInput<PIN_GONG> btnGong;                              // onPress - start of the ring
+
+  // Bank of the buttons - debounced together, the buttons read their state from it
+  ButtonBank buttons;
+
+  // Chords of the buttons - the single-button events of the buttons of a chord are discarded
+  const ButtonChord chord_table[] PROGMEM = {
+    // buttons                          hold              repeat delay         repeat time         priority flags                action
+    {BANK_BTN_MENU | BANK_BTN_STOP,     RESET_TIME,       0,                   0,                  3,       BUTTON_CHORD_ALWAYS, resetChord},      // M + O - reset
+    {BANK_BTN_MENU | BANK_BTN_PREVIOUS, 0,                VOLUME_REPEAT_DELAY, VOLUME_REPEAT_TIME, 2,       0,                   volumeDownChord}, // M + <
+    {BANK_BTN_MENU | BANK_BTN_NEXT,     0,                VOLUME_REPEAT_DELAY, VOLUME_REPEAT_TIME, 2,       0,                   volumeUpChord},   // M + >
+    {BANK_BTN_MENU,                     BUTTON_LONG_TIME, 0,                   0,                  1,       0,                   testChord},       // M long - test
+  };
+  ButtonChords chords;
   
   // DFRPlayer instance
-  DFRobotDFPlayerMini myDFPlayer;
+  DFPlayerDriver<DFPlayerUsart> myDFPlayer;
+
+  // DFRPlayer serial port - frames are received in the interrupt
+  DFPlayerUsart playerSerial;
+
+#if ZONES > 1
+  // player of the zone 2 on the serial port USART0 (Serial)
+  DFRobotDFPlayerMini zone2Player;
+  struct GongSettings zone2Settings = {ZONE2_FOLDER, ZONE2_FILE, MODE_ONE, ZONE2_VOLUME, false, false, true};
+#endif
 
   // LED blink instance
-  LedBlink led;
+  FastLed<PIN_LED> led;
+
+  // BUSY pin of the player
+  DFPlayerBusy<PIN_BUSY> playerBusy;
   
   // LED blink status
   int blink_status = BLINK_IDLE;
@@ -263,6 +444,14 @@ struct Timer {
 
   struct GongSettings gong[GONGS]; //saved settings
 
+  // zones (zone 0 - the doorbell player, its events are handled by playerUpdate())
+  struct Zone zones[ZONES] = {
+    {&myDFPlayer, PIN_BUSY, nullptr, 0, gong + NORMAL},
+#if ZONES > 1
+    {&zone2Player, ZONE_NO_BUSY, nullptr, 0, &zone2Settings},
+#endif
+  };
+
   int gong_index = EDITED; // NORMAL | EDITE
 
   //timer for edited settings
@@ -271,36 +460,97 @@ struct Timer {
   // flag EDIT mode
   bool edit_flag = false;
 
+  // pending query of file counts for MODE_RANDOM (DFPLAYER_NO_HANDLE - none)
+  uint8_t random_query = DFPLAYER_NO_HANDLE;
+
+  // pending query of file counts for the file error of STATUS_NEXT_FILE / STATUS_PREVIOUS_FILE
+  uint8_t error_query = DFPLAYER_NO_HANDLE;
+  uint8_t error_status;                    // status of the failed file
+
+  // handle of the last play command
+  uint8_t play_handle = DFPLAYER_NO_HANDLE;
+
+  // stop sent while playing - its BUSY OFF is not the end of the playback
+  bool stopping = false;
+  unsigned int stop_time;                  // time of the stop
+
+  // playlist - ring of the clips played after the current one
+  struct Clip playlist[PLAYLIST_LENGTH];
+  uint8_t playlist_head = 0;               // next clip
+  uint8_t playlist_count = 0;              // waiting clips
+  unsigned int clip_end;                   // end of the previous clip - start of the gap
+  bool clip_gap = false;                   // the next clip was sent, its start (BUSY ON) is awaited
+  unsigned int playlist_gap_max = 0;       // longest measured gap between two clips (ms)
+
+  // prompt inserted by advertise()
+  uint8_t advert_message = MESSAGE_NOTHING; // message being inserted (played by play() if the insert fails)
+  unsigned int advert_time;                // time of advertise()
+  bool advert_missing = false;             // the card has no ADVERT folder - all messages by play()
+
+  // volume gesture M + < / M + >
+  unsigned int volume_changed;             // time of the last volume change
+  bool volume_prompt = false;              // the volume message is waiting
+
+  // player power
+  uint8_t player_power = POWER_ON;         // POWER_*
+  unsigned long idle_timer;                // start of the quiet period
+  unsigned int wake_start;                 // time of the wake (gong press)
+  unsigned int wake_latency_max = 0;       // longest measured time from the wake to the first sound (ms)
+
+  // player recovery
+  uint8_t player_state = PLAYER_RESETTING; // PLAYER_*
+  unsigned int recovery_timer;             // start of the current state
+  unsigned int recovery_start;             // start of the recovery
+  unsigned int recovery_backoff;           // pause before the next attempt
+  uint8_t recovery_attempts;               // attempts of the current recovery
+  bool ring_pending = false;               // gong pressed while the player was not responding
+  bool start_message = false;              // play the start message when the player is online
+  bool settings_loaded = false;            // settings were loaded from EEPROM (false - reset to default)
+
 ////////////////////////////////// MAIN //////////////////////////////////////
 
 /// @brief Main SETUP function
 void setup() {
   
-  init_general(); // init doorbell 
+  init_hardware();
+  init_doorbell(); // the player is started in the background
+}
+
+/// @brief Initialization of the doorbell and the settings (also after the card is inserted)
+void init_doorbell() {
+  
+  init_general();
   
   // try load settings from EEPROM
-  if (!load()) {
-    delay(100);
-    while(getBusy());
-  }
+  settings_loaded = load();
   edit_flag = false;
   
-  myDFPlayer.playFolder(FOLDER_MESSAGE, MESSAGE_START);
-  led.blink(blink_start);
+  start_message = true; // played when the player is online
 }
 
 /// @brief Main LOOP function
 void loop() {
   
+  // The player is not responding - only the gong and the LED are serviced until it is back
+  if (!playerRecovery()) {
+    if (btnGong.onPress()) {
+      T("> Ring pending, player is not responding"); NL;
+      ring_pending = true;
+    }
+    buttonEvents();
+    blink(BLINK_PLAYER_ERROR);
+    led.update();
+    return;
+  }
+
   // If the card is removewd, wait for it to be inserted
   while (status == STATUS_CARD_REMOVED) {
     led.update();
     playerUpdate();
   }
 
-  // If the RESET key combination is pressed, call the reset function
-  if (btnStop.pressed() && btnMode.pressed()) 
-    tryReset();
+  // Chords: M + O reset (also when the buttons are locked), M + < / M + > volume, M long test
+  bool chord = chords.update(wait_for_player_response);
    
   if (btnGong.onPress()) {
       NL;
@@ -331,28 +581,11 @@ void loop() {
         } 
     }
     
-    if(btnMode.pressed()) {
-      if(btnPrev.onClick()) {
-        NL;
-        btnMode.reset();
-        volumeDownAction();
-      } 
-
-      else if(btnNext.onClick()) {
-        NL;
-        btnMode.reset();
-        volumeUpAction();
-      }
-
-      else if (btnMode.onLong()) {
-        NL;
-        testAction();
-      }
-    } 
-    
-    
+    if (chord) {
+      // a chord is in progress - the single-button events are not used
+    }
 
-    if (btnPrev.onClick()) {
+    else if (btnPrev.onClick()) {
       NL;
       prevFileAction();
     }
@@ -394,13 +627,14 @@ void loop() {
 
   // Update DFR0299 Player
   playerUpdate();
+  playRandom();
+  fileErrorCount();
+  idlePower();
+  updateZones();
+  volumePrompt();
 
-  // Update buttons
-  btnPrev.update();
-  btnNext.update();
-  btnMode.update();
-  btnStop.update();
-  btnGong.update();
+  // Button events from the timer interrupt
+  buttonEvents();
 
   // Update LED blinking
   led.update();
@@ -449,6 +683,10 @@ void blink(int status) {
       case BLINK_GENERAL_ERROR:
         led.blink(blink_general_error);
         break;
+
+      case BLINK_PLAYER_ERROR:
+        led.blink(blink_player_error);
+        break;
     }
   }
 }
@@ -457,61 +695,192 @@ void blink(int status) {
 /// @param reset If the value is false, the current state is not deleted
 /// @return BUSY state: -1 - to OFF, 1 - to ON, 0 - the BUSY state has not changed
 int edgeBusy(bool reset) {
-  static bool previous_busy = false;
-  bool busy = digitalRead(PIN_BUSY) == LOW;
-  
-  if (busy != previous_busy) {
-    if (reset) 
-      previous_busy = busy;
-    return busy ? 1 : -1;
-  }
-  else 
-    return 0;
+  return playerBusy.edge(reset);
 }
 
 /// @brief It returns state of BUSY pin. 
 /// @return true - LOW (ON), false - HIGH (OFF)
 bool getBusy() {
-  return digitalRead(PIN_BUSY) == LOW;
+  return playerBusy.busy();
 }
 
-/// @brief Counts the files in a folder
+/// @brief Returns the count of files in the folder without waiting for the player.
+///        The first call sends the query, the answer is cached in the player driver until
+///        the card is changed - large folders are counted by the player only once.
 /// @param folder Folder number
-/// @return Number of files
-int getFileCountsInFolder(uint8_t folder) {
-      int count = myDFPlayer.readFileCountsInFolder(folder); //deBUG zzz need read 2x!
-      count = myDFPlayer.readFileCountsInFolder(folder);
-      T("> readFileCountsInFolder("); D(folder); T(") = "); D(count); NL;
-      return count;
+/// @return Number of files, -1 - not known yet (the query is in progress or failed)
+int fileCount(uint8_t folder) {
+  uint8_t handle = myDFPlayer.queryFileCountsInFolder(folder);
+  if (myDFPlayer.commandStatus(handle) != DFPLAYER_COMMAND_DONE) return -1;
+  return myDFPlayer.queryValue(handle);
 }
 
 
-/// @brief Main Initialization
-void init_general() {
+/// @brief Starts the player initialization in the background, see playerRecovery()
+void startRecovery() {
+  T("> Player recovery started"); NL;
+  recovery_attempts = 0;
+  recovery_backoff = RECOVERY_BACKOFF_MIN;
+  recovery_start = millis();
+  resetPlayer();
+}
+
+/// @brief One attempt of the player initialization - the player is reset, its answer is awaited in playerRecovery()
+void resetPlayer() {
+  recovery_attempts++;
+  T("> Player reset, attempt "); D(recovery_attempts); NL;
+  myDFPlayer.begin(playerSerial, true, false); // clears the command queue, does not wait
+  myDFPlayer.reset();
+  player_state = PLAYER_RESETTING;
+  recovery_timer = millis();
+}
+
+/// @brief Player recovery state machine; retries the initialization with exponential backoff
+/// @return true - the player is online
+bool playerRecovery() {
+  if (player_state == PLAYER_ONLINE) return true;
+
+  if (player_state != PLAYER_SETTLING && myDFPlayer.available()) {
+    uint8_t type = myDFPlayer.readType();
+    if (type == DFPlayerCardOnline || type == DFPlayerUSBOnline || type == DFPlayerCardUSBOnline) {
+      player_state = PLAYER_SETTLING; // also a late answer or the player powered on later
+      recovery_timer = millis();
+    }
+  }
+
+  switch (player_state) {
+    case PLAYER_RESETTING:
+      if (((unsigned int) millis()) - recovery_timer > RECOVERY_RESET_TIME) {
+        T("> Player not responding, next attempt in "); D(recovery_backoff); T(" ms"); NL;
+        player_state = PLAYER_BACKOFF;
+        recovery_timer = millis();
+      }
+      break;
+
+    case PLAYER_BACKOFF:
+      if (((unsigned int) millis()) - recovery_timer > recovery_backoff) {
+        if (recovery_backoff < RECOVERY_BACKOFF_MAX) recovery_backoff *= 2;
+        resetPlayer();
+      }
+      break;
+
+    case PLAYER_SETTLING:
+      myDFPlayer.available();
+      if (((unsigned int) millis()) - recovery_timer > RECOVERY_SETTLE_TIME) {
+        player_state = PLAYER_ONLINE;
+        playerOnline();
+        return true;
+      }
+      break;
+  }
+  return false;
+}
+
+/// @brief The player is online: reports the recovery, plays the start message and the pending ring
+void playerOnline() {
+  T("> Player online, attempts: "); D(recovery_attempts);
+  T(", time to recover: "); D(((unsigned int) millis()) - recovery_start); T(" ms"); NL;
+
+  myDFPlayer.setTimeOut(500);
+  myDFPlayer.volume(DEFAULT_VOLUME);
+  player_power = POWER_ON; // the reset woke the player
+  idle_timer = millis();
+  fileCount(gong[NORMAL].folder); // counted in the background, ready for the next ring
+  wait_for_player_response = false;
+  status = STATUS_IDLE;
+  blink(BLINK_IDLE);
+
+  if (start_message) {
+    start_message = false;
+    if (!settings_loaded) { // settings were reset to default
+      status = STATUS_MESSAGE;
+      play(FOLDER_MESSAGE, MESSAGE_RESET_BELL);
+      queueClip(FOLDER_MESSAGE, MESSAGE_START); // follows the reset message
+    }
+    else {
+      myDFPlayer.playFolder(FOLDER_MESSAGE, MESSAGE_START);
+    }
+    led.blink(blink_start);
+  }
+
+  if (ring_pending) {
+    ring_pending = false;
+    playAction();
+  }
+}
+
+/// @brief Delivers the button events queued in the timer interrupt (in order, to onPress(), onClick()...)
+void buttonEvents() {
+  ButtonEvent event;
+  while (buttons.read(event)) {
+    if (buttons.button(event.button) == &btnGong) {
+      if (event.type == BUTTON_EVENT_PRESS) {
+        T("> Gong detected in "); D(btnGong.latency()); T(" us, ");
+        T("pressed "); D((uint16_t)((uint16_t)millis() - event.time)); T(" ms ago"); NL;
+      }
+      else if (event.type == BUTTON_EVENT_RELEASE) {
+        T("> Gong signal ");
+        switch (btnGong.signal()) {
+          case GONG_SIGNAL_AC: T("AC"); break;
+          case GONG_SIGNAL_CONTACT: T("contact"); break;
+          default: T("DC"); break;
+        }
+        T(", pulses "); D(btnGong.pulses()); NL;
+      }
+    }
+    buttons.deliver(event);
+  }
+}
+
+/// @brief One-time initialization of the hardware: serial ports, pins, buttons and their timer
+void init_hardware() {
   
-  Serial1.begin(9600);  //DFPlayer
+  playerSerial.begin(9600, myDFPlayer);  //DFPlayer
+#if ZONES > 1
+  Serial.begin(9600); //DFPlayer of the zone 2
+#else
   Serial.begin(115200); //Serial debug
-  led.begin(PIN_LED, OFF);
+#endif
+  led.begin(OFF);
+  playerBusy.begin();
+  for (uint8_t i = 0; i < ZONES; i++) { // BUSY of the zones is read from the port register - no pin lookup in loop()
+    if (zones[i].pin_busy == ZONE_NO_BUSY) continue;
+    zones[i].busy_in = portInputRegister(digitalPinToPort(zones[i].pin_busy));
+    zones[i].busy_mask = digitalPinToBitMask(zones[i].pin_busy);
+  }
  
   NL; T(VERSION); NL; NL;
   
   // Buttons starting 
+  buttons.add(btnPrev);
+  buttons.add(btnNext);
+  buttons.add(btnMode);
+  buttons.add(btnStop);
+  buttons.add(btnGong);
+  
   btnPrev.start();
   btnNext.start();
   btnMode.start();
   btnStop.start();
-  btnGong.start();
-  
+  btnGong.begin();
+  buttons.beginTimer(); // the buttons are sampled in the TCB0 interrupt
+  chords.begin(buttons, chord_table, sizeof(chord_table) / sizeof(chord_table[0])); // the held buttons are ignored until released
+
+  printButtonCosts(); // measured once at power-on
+}
+
+/// @brief Main Initialization: the player and the gong structure (also by the reset chord - the hardware is kept)
+void init_general() {
+
+#if ZONES > 1
+  zone2Player.begin(Serial, true, false); // not waiting - the zone is initialized in the background
+  zone2Player.reset();
+#endif
+
   editTimer.begin(EDIT_TIME);
 
-  // Initialize player
-  while ( !myDFPlayer.begin(Serial1, true, true)) {
-   led.blink(blink_player_error);
-   while(led.isBlinking) led.update();
-  };
- 
-  myDFPlayer.setTimeOut(500);
-  myDFPlayer.volume(DEFAULT_VOLUME);
+  // Initialize player (in the background - playerRecovery())
+  startRecovery();
   
   init_gong(); // initialize gong structure
  
@@ -541,86 +910,166 @@ void init_gong() {
 }
 
 /// @brief Start playing the file
-/// @param folder Folder number (1-9)
-/// @param file File number (1 -255)
-void play(uint8_t folder, uint8_t file) {
+/// @param folder Folder number (1-9, FOLDER_MESSAGE)
+/// @param file File number (1 -255, 1 - 3000 in the ringtone folders if LARGE_LIBRARY)
+void play(uint8_t folder, uint16_t file) {
   
   T("> PLAY");  T(", folder = "); D(folder); T(", file = ");  D(file); NL;
 
-  stop();
+  clearPlaylist(); // the waiting clips belong to the stopped playback
+  if (player_power == POWER_SLEEP) 
+    wakePlayer(); // a sleeping player plays nothing - no stop, it would only delay the wake
+  else if (player_power == POWER_ON) 
+    stop();
   T("PLAYER> busy switch to "); D(edgeBusy()); NL;
 
+  startClip(folder, file);
+}
+
+/// @brief Sends the play command (the playback is not stopped - the previous clip has ended)
+/// @param folder Folder number (1-9, FOLDER_MESSAGE)
+/// @param file File number
+void startClip(uint8_t folder, uint16_t file) {
   T("> DFR playFolder()! ");
   wait_for_player_response = true;
-  myDFPlayer.volume(gong[gong_index].volume);
-  delay(10);
-  myDFPlayer.playFolder(folder, file);
+  myDFPlayer.volume(gong[gong_index].volume); // sent only if the volume is changed
+#ifdef LARGE_LIBRARY
+  if (folder != FOLDER_MESSAGE) 
+    play_handle = myDFPlayer.playLargeFolder(folder, file); // 4-digit file names
+  else
+#endif
+  play_handle = myDFPlayer.playFolder(folder, file);
+  if (zones[0].ringing && (zones[0].play_handle == DFPLAYER_NO_HANDLE))
+    zones[0].play_handle = play_handle; // the ring of zone 0 (in MODE_RANDOM after the count of files)
   T("Done."); NL;
 }
 
-/// @brief Stop playback and cancel editing mode
-void stop() {
-  unsigned int timer = millis();
-  
-  myDFPlayer.stop();
-  delay(50);
-  
-  timer = millis();
-
-  while(getBusy());
+/// @brief Appends the clip to the playlist; it starts when the current clip ends
+/// @param folder Folder number
+/// @param file File number
+/// @param clip_status Status while the clip is playing (file errors are handled according to it)
+/// @return false - the playlist is full
+bool queueClip(uint8_t folder, uint16_t file, uint8_t clip_status) {
+  if (playlist_count >= PLAYLIST_LENGTH) return false;
+
+  struct Clip *clip = playlist + (playlist_head + playlist_count) % PLAYLIST_LENGTH;
+  clip->folder = folder;
+  clip->file = file;
+  clip->status = clip_status;
+  playlist_count++;
+  return true;
+}
 
-  timer = (unsigned int) millis() - timer; 
-  T("> (stop) - delay time: ");
-  D(timer);
-  T(" ms");
-  NL;
+/// @brief Removes the waiting clips
+void clearPlaylist() {
+  playlist_count = 0;
+  clip_gap = false;
 }
 
-/// @brief The function checks for pressing the O and M buttons for 10 seconds, then performs a reset
-void tryReset() {
+/// @brief The clip ended (BUSY OFF or 0x3D frame, whichever comes first) - starts the next clip at once
+/// @return true - the playlist continues, false - the playback ended
+bool nextClip() {
+  // the other end signal of the previous clip - the next one is already starting
+  if (clip_gap && (((unsigned int) millis()) - clip_end < PLAYLIST_END_GUARD)) return true;
+  clip_gap = false;
   
-  unsigned int timer = millis();
-  bool doReset = true;
+  if (playlist_count == 0) return false;
+
+  struct Clip *clip = playlist + playlist_head;
+  playlist_head = (playlist_head + 1) % PLAYLIST_LENGTH;
+  playlist_count--;
+
+  clip_end = millis();
+  clip_gap = true;
+  status = clip->status;
+  T("> Playlist: next clip, folder = "); D(clip->folder); T(", file = "); D(clip->file); NL;
+  startClip(clip->folder, clip->file);
+  return true;
+}
 
-  // wait 10 sec. (RESET_TIME)
-  while ( ((unsigned int) millis()) - timer  < RESET_TIME) {
-    if (!btnStop.pressed() || !btnMode.pressed() && !btnPrev.pressed() && !btnNext.pressed()) {
-      doReset = false;
-      break;
+/// @brief Wakes the sleeping player. The commands are only queued: the device selection
+///        (wakes the player, 200 ms gap in the driver), DAC on and then the play command of the caller.
+///        The time to the first sound is measured in playerUpdate() and bounded in idlePower().
+void wakePlayer() {
+  if (player_power != POWER_SLEEP) return;
+
+  T("> Wake the player"); NL;
+  wake_start = millis();
+  player_power = POWER_WAKING;
+  myDFPlayer.outputDevice(DFPLAYER_DEVICE_SD);
+  myDFPlayer.enableDAC();
+}
+
+/// @brief Puts the player to sleep after IDLE_SLEEP_TIME without activity;
+///        resets the player if it does not play in WAKE_TIMEOUT after the wake
+void idlePower() {
+  if (player_power == POWER_WAKING) {
+    if (((unsigned int) millis()) - wake_start > WAKE_TIMEOUT) {
+      T("> Player did not wake up in "); D(WAKE_TIMEOUT); T(" ms"); NL;
+      player_power = POWER_ON;
+      ring_pending = (status & STATUS_PLAY) != 0; // the ring is played when the player is online
+      startRecovery();
     }
-    
-    btnPrev.update();
-    btnNext.update();
-    btnStop.update();
-    btnMode.update();
+    return;
   }
 
-  if (doReset) {
-    
-    stop();
-    init_general();
-    save();
-    
-    
-
-    led.blink(blink_start);
+  if ((player_power != POWER_ON) || (status != STATUS_IDLE) || edit_flag || wait_for_player_response || 
+      (random_query != DFPLAYER_NO_HANDLE) || getBusy()) {
+    idle_timer = millis();
+    return;
+  }
 
-    
+  if (IDLE_SLEEP_TIME && (millis() - idle_timer > IDLE_SLEEP_TIME)) {
+    T("> Player sleeps"); NL;
+    myDFPlayer.disableDAC();
+    myDFPlayer.sleep();
+    player_power = POWER_SLEEP;
+  }
+}
 
-    while (getBusy() || btnStop.pressed() || btnMode.pressed() || btnPrev.pressed() || btnNext.pressed()) { //wait for end play jingel
-      led.update();
-      btnPrev.update();
-      btnNext.update();
-      btnStop.update();
-      btnMode.update();
-    }
-    btnPrev.reset();
-    btnNext.reset();
-    btnStop.reset();
-    btnMode.reset();
-    myDFPlayer.playFolder(FOLDER_MESSAGE, MESSAGE_RESET_BELL);
+/// @brief Plays the UI message. If a ringtone preview is playing, the message is inserted by
+///        advertise() and the preview continues after it (no stop and restart); otherwise
+///        (or if the insert fails, see advertFailed()) it is played by play() from FOLDER_MESSAGE.
+/// @param message Message number MESSAGE_*
+void prompt(uint8_t message) {
+#ifdef ADVERT_PROMPTS
+  bool preview = (status == STATUS_NEXT_FILE) || (status == STATUS_PREVIOUS_FILE) || (status & STATUS_PLAY_TEST);
+  if (preview && !advert_missing && (player_power == POWER_ON) && getBusy()) {
+    T("> Prompt "); D(message); T(" by advertise()"); NL;
+    advert_message = message;
+    advert_time = millis();
+    myDFPlayer.advertise(message);
+    return;
   }
+#endif
+  status = STATUS_MESSAGE;
+  play(FOLDER_MESSAGE, message);
+}
+
+/// @brief Tests whether the player error belongs to the last advertise() and plays the message normally
+/// @param file_error true - file error (the ADVERT folder is missing, it is not used until the card is changed)
+/// @return true - the error was handled
+bool advertFailed(bool file_error) {
+  uint8_t message = advert_message;
+  advert_message = MESSAGE_NOTHING;
+  if ((message == MESSAGE_NOTHING) || (((unsigned int) millis()) - advert_time > ADVERT_ERROR_TIME)) return false;
+
+  T("> advertise() failed, message played by play()"); NL;
+  if (file_error) advert_missing = true;
+  status = STATUS_MESSAGE;
+  play(FOLDER_MESSAGE, message);
+  return true;
+}
+
+/// @brief Stop playback and cancel editing mode. The stop is only queued - the next play command
+///        follows it in the queue; the BUSY OFF it causes is dropped by playerEvent().
+void stop() {
+  if (player_power == POWER_SLEEP) return; // nothing is playing
   
+  myDFPlayer.stop();
+  stopping = getBusy();
+  stop_time = millis();
+  T("> (stop) queued"); NL;
 }
 
 /// @brief The function unlocks the buttons after 2 seconds of player inactivity
@@ -637,7 +1086,11 @@ void unblockLockedButtons() {
   
   if (wait_for_player_response) {
     if (((unsigned int) millis()) - lock_timer > LOCK_BUTTONS_TIME) {
+      printPlayerStats(); // the player did not respond
       stopAction(); //unlock
+      if (myDFPlayer.commandStatus(play_handle) == DFPLAYER_COMMAND_FAILED) {
+        startRecovery(); // the play command was not acknowledged
+      }
     }
   }
 }
@@ -648,6 +1101,11 @@ int playerEvent() {
   int busy = edgeBusy();
   int event = PLAYER_NO_EVENT;
   
+  if (stopping && ((busy != 0) || (((unsigned int) millis()) - stop_time > STOP_TIMEOUT))) {
+    stopping = false;
+    if (busy == -1) return PLAYER_NO_EVENT; // the stopped playback, not the end of the clip
+  }
+
   // test Busy event
   if (busy != 0) {
     event = (busy == 1) ? PLAYER_BUSY_ON : PLAYER_BUSY_OFF;
@@ -666,6 +1124,9 @@ int playerEvent() {
           case FileIndexOut:
             event = PLAYER_FILE_ERROR;
             break;
+          case Advertise: // advertise() while nothing is playing
+            event = PLAYER_ADVERT_ERROR;
+            break;
         }
         break;
 
@@ -676,6 +1137,10 @@ int playerEvent() {
       case DFPlayerCardRemoved:
         event = PLAYER_CARD_REMOVED;
         break;
+
+      case DFPlayerPlayFinished:
+        event = PLAYER_FINISHED;
+        break;
             
       default:
         event = PLAYER_OTHER_ERROR;
@@ -710,6 +1175,12 @@ void printEvent(int event) {
     case PLAYER_OTHER_ERROR:
       T("PLAYER_OTHER_ERROR");
       break;
+    case PLAYER_FINISHED:
+      T("PLAYER_FINISHED");
+      break;
+    case PLAYER_ADVERT_ERROR:
+      T("PLAYER_ADVERT_ERROR");
+      break;
     default:
       T("UNKNOWN EVENT ("); D(event);T("("); 
       break;
@@ -734,6 +1205,63 @@ void printStatus(int status) {
   } 
 }
 
+#ifdef DEBUG_ON
+/// @brief Measures update() of the button (not in the bank - the pin is read)
+/// @return CPU cycles of one update()
+template <class EventButtonType>
+unsigned int updateCycles(EventButtonType &button) {
+  const unsigned int count = 100;
+  unsigned long start = micros();
+  for (unsigned int i = 0; i < count; i++) button.update();
+  return (micros() - start) * (F_CPU / 1000000UL) / count;
+}
+#endif
+
+/// @brief Prints the RAM of an instance and the cycles of update() of the button configurations
+void printButtonCosts() {
+#ifdef DEBUG_ON
+  RealButton real(PIN_BTN_STOP);
+  PolicyButton<ButtonPolicy> all(PIN_BTN_STOP);
+  PolicyButton<ButtonClickPolicy> click(PIN_BTN_STOP);
+  PolicyButton<ButtonPressPolicy> press(PIN_BTN_STOP);
+
+  T("> Buttons (RAM, cycles of update()):"); NL;
+  T("  RealButton "); D(sizeof(real)); T(" B, "); D(updateCycles(real)); NL;
+  T("  PolicyButton<ButtonPolicy> "); D(sizeof(all)); T(" B, "); D(updateCycles(all)); NL;
+  T("  PolicyButton<ButtonClickPolicy> "); D(sizeof(click)); T(" B, "); D(updateCycles(click)); NL;
+  T("  PolicyButton<ButtonPressPolicy> "); D(sizeof(press)); T(" B, "); D(updateCycles(press)); NL;
+#endif
+}
+
+/// @brief Writes the player protocol counters and latency histograms to Serial
+void printPlayerStats() {
+#ifdef DEBUG_ON
+  DFPlayerStats stats = myDFPlayer.stats();
+
+  T("> Player stats: sent "); D(stats.framesSent);
+  T(", received "); D(stats.framesReceived);
+  T(", retransmits "); D(stats.retransmits); NL;
+  T("  errors: header "); D(stats.headerErrors);
+  T(", length "); D(stats.lengthErrors);
+  T(", end "); D(stats.endErrors);
+  T(", checksum "); D(stats.checkSumErrors);
+  T(", resyncs "); D(stats.resyncs);
+  T(", overruns "); D(stats.overruns);
+  T(", player "); D(stats.playerErrors); NL;
+  T("  timeouts: ack "); D(stats.ackTimeouts);
+  T(", query "); D(stats.queryTimeouts);
+  T(", wait "); D(stats.timeOuts); NL;
+  
+  // bucket n: 2^n ms and more
+  T("  ack latency:  ");
+  for (int i = 0; i < DFPLAYER_LATENCY_BUCKETS; i++) { D(stats.ackLatency[i]); T(" "); }
+  NL;
+  T("  query latency: ");
+  for (int i = 0; i < DFPLAYER_LATENCY_BUCKETS; i++) { D(stats.queryLatency[i]); T(" "); }
+  NL;
+#endif
+}
+
 ///////////////////////////////// ACTION FUNCTIONS ////////////////////////////////
 
 void playAction(bool test = false) {
@@ -754,19 +1282,24 @@ void playAction(bool test = false) {
   
   blink(BLINK_PLAY);
 
+  wakePlayer(); // at once - also the file counts query needs the player awake
+
   gong_index = NORMAL;
 
   // If file is not ready to play - generate new file number
   if (!gong[NORMAL].ready) {
     if (gong[NORMAL].mode == MODE_NEXT) {
       gong[NORMAL].file++;
+      
+      // wrap to the first file without a failed play, if the count of files is already known
+      int count = fileCount(gong[NORMAL].folder);
+      if (((count > 0) && (gong[NORMAL].file > count)) || (gong[NORMAL].file > FILE_LAST)) 
+        gong[NORMAL].file = 1;
     } 
 
     else if  (gong[NORMAL].mode == MODE_RANDOM) {
-      int file_count = getFileCountsInFolder(gong[NORMAL].folder);
-      T(">  myDFPlayer.readFileCountsInFolder("); D(file_count); T(") = ");
-      gong[NORMAL].file = random(1, file_count + 1);
-      D(gong[NORMAL].file); NL;
+      // the file is selected in playRandom() when the player answers
+      random_query = myDFPlayer.queryFileCountsInFolder(gong[NORMAL].folder);
     }
   }
 
@@ -792,8 +1325,14 @@ void playAction(bool test = false) {
   }
   else {
     gong[NORMAL].ready = false;
+    ringZones();
   }
   
+  if (random_query != DFPLAYER_NO_HANDLE) {
+    wait_for_player_response = true;
+    return; // playRandom() starts playing
+  }
+
   play(gong[NORMAL].folder, gong[NORMAL].file);
 }
 
@@ -801,6 +1340,8 @@ void stopAction() {
   NL; T("* Action: Stop"); NL;
 
   status = STATUS_IDLE;
+  random_query = DFPLAYER_NO_HANDLE;
+  error_query = DFPLAYER_NO_HANDLE;
   
   stop();
   wait_for_player_response = false;
@@ -842,6 +1383,16 @@ void volumeDownAction() {
   volumeDown();
 }
 
+void resetAction() {
+  NL; T("* Action: Reset"); NL;
+  stop();
+  init_general();
+  save();
+  edit_flag = false;
+  settings_loaded = false; // playerOnline() plays the reset message and the start message
+  start_message = true;
+}
+
 void nextPlayModeAction() {
   NL; T("* Action: Next Play Mode Action"); NL;
 
@@ -850,23 +1401,21 @@ void nextPlayModeAction() {
   gong[EDITED].mode ++;
   gong[EDITED].mode %= 3;
   
-  status = STATUS_MESSAGE;
-
   T("> Mode set to ");
   switch (gong[EDITED].mode) {
     case MODE_ONE:
        T("ONE"); NL;
-      play(FOLDER_MESSAGE, MESSAGE_MODE_ONE);
+      prompt(MESSAGE_MODE_ONE);
       break;
     
     case MODE_NEXT:
       T("NEXT"); NL;
-      play(FOLDER_MESSAGE, MESSAGE_MODE_NEXT);
+      prompt(MESSAGE_MODE_NEXT);
       break;
 
     case MODE_RANDOM:
       T("RANDOM"); NL;
-      play(FOLDER_MESSAGE, MESSAGE_MODE_RANDOM);
+      prompt(MESSAGE_MODE_RANDOM);
       break;
   }
 }
@@ -881,6 +1430,29 @@ void saveAction() {
     save();
 }
 
+/////////////////////////////// CHORD ACTIONS //////////////////////////////////
+
+void resetChord(bool repeat) {
+  resetAction();
+}
+
+void testChord(bool repeat) {
+  NL;
+  testAction();
+}
+
+/// @brief M + > - volume up, fine steps while held
+void volumeUpChord(bool repeat) {
+  if (repeat) volumeStep(VOLUME_REPEAT_STEP);
+  else volumeUpAction();
+}
+
+/// @brief M + < - volume down, fine steps while held
+void volumeDownChord(bool repeat) {
+  if (repeat) volumeStep(-VOLUME_REPEAT_STEP);
+  else volumeDownAction();
+}
+
 /////////////////////////////// EXECUTIVE FUNCTIONS //////////////////////////////////
 
 /// @brief Tests whether the player sent the event and handles it
@@ -895,6 +1467,9 @@ void playerUpdate() {
         T("Update PLAYER> File Error, status: "); 
         printStatus(status);
         NL;
+        printPlayerStats();
+        if (advertFailed(true)) break; // the inserted message, not the preview
+        clearPlaylist();
 
         switch (status & ~STATUS_PLAY_TEST) {
           case STATUS_PLAY_ONE:
@@ -921,46 +1496,21 @@ void playerUpdate() {
             break;
           
           case STATUS_NEXT_FILE:
-              T("> playerUpdate(), FILE ERROR, STATUS_NEXT_FILE gong_index = " ); D(gong_index); NL;
-              if ((getFileCountsInFolder(gong[gong_index].folder)  < 1) || 
-                  (gong[gong_index].file == 1) 
-                 ) {
-                      status = STATUS_MESSAGE;
-
-                      gong[gong_index].first = true;
-                      gong[gong_index].file = 1;
-                      
-                      play(FOLDER_MESSAGE, MESSAGE_FOLDER_EMPTY);
-                    } 
-              
-              else {
-
-                gong[gong_index].last  = true;
-                gong[gong_index].first = false;
-                gong[gong_index].ready = true;
-                gong[gong_index].file--;
-                
+          case STATUS_PREVIOUS_FILE:
+              T("> playerUpdate(), FILE ERROR, gong_index = " ); D(gong_index); NL;
+              if (gong[gong_index].file == 1) {
                 status = STATUS_MESSAGE;
-                play(FOLDER_MESSAGE, MESSAGE_LAST_FILE_IN_FOLDER);                
-
-                
+                gong[gong_index].first = true;
+                play(FOLDER_MESSAGE, MESSAGE_FOLDER_EMPTY);
+              }
+              else {
+                // the message depends on the count of files - decided in fileErrorCount() when the player answers
+                error_status = status & ~STATUS_PLAY_TEST;
+                error_query = myDFPlayer.queryFileCountsInFolder(gong[gong_index].folder);
+                wait_for_player_response = true;
               }
               break;
 
-          case STATUS_PREVIOUS_FILE:
-            if ((gong[gong_index].file == 1 )
-                  || (getFileCountsInFolder(gong[gong_index].folder) < 1)) {
-                    status = STATUS_MESSAGE;
-                    gong[gong_index].first = true;
-                    gong[gong_index].file = 1;
-                    play(FOLDER_MESSAGE, MESSAGE_FOLDER_EMPTY);
-                  }
-            else {
-              status = STATUS_MESSAGE;
-              play(FOLDER_MESSAGE, MESSAGE_FILE_SYSTEM_ERROR);
-            }
-            break;
-
 
             case STATUS_PLAY_DEFAULT:
               
@@ -976,34 +1526,152 @@ void playerUpdate() {
       case PLAYER_BUSY_OFF:
         if (status != STATUS_CARD_REMOVED) {
           T("Update PLAYER> Player Busy OFF"); NL; 
+          if (nextClip()) break; // the playlist continues
           status = STATUS_IDLE;
         }
         break;
 
+      case PLAYER_FINISHED:
+        T("Update PLAYER> Track finished"); NL;
+        if (status != STATUS_CARD_REMOVED && nextClip()) break; // usually before BUSY OFF - the shortest gap
+        wait_for_player_response = false;
+        break;
+
       case PLAYER_BUSY_ON:
         wait_for_player_response = false;
         T("Update PLAYER> Player Busy ON "); NL; 
+        if (player_power == POWER_WAKING) { // the first sound after the wake
+          unsigned int latency = ((unsigned int) millis()) - wake_start;
+          player_power = POWER_ON;
+          if (latency > wake_latency_max) wake_latency_max = latency;
+          T("> Wake latency: "); D(latency); T(" ms (max "); D(wake_latency_max); T(" ms)"); NL;
+        }
+        if (clip_gap) { // the next clip of the playlist started
+          unsigned int gap = ((unsigned int) millis()) - clip_end;
+          clip_gap = false;
+          if (gap > playlist_gap_max) playlist_gap_max = gap;
+          T("> Playlist gap: "); D(gap); T(" ms (max "); D(playlist_gap_max); T(" ms)"); NL;
+        }
         break;
 
       case PLAYER_CARD_REMOVED:
 
         T("Update PLAYER> CARD REMOVED"); NL;
+        clearPlaylist();
         blink(BLINK_GENERAL_ERROR);
         status = STATUS_CARD_REMOVED;
         break;
 
       case PLAYER_CARD_INSERTED:
          T("> Update PLAYER> CARD INSERTED"); NL;
-        setup();
+        advert_missing = false;
+        init_doorbell();
         init_gong();
         break;
 
+      case PLAYER_ADVERT_ERROR:
+        if (advertFailed(false)) break;
+        wait_for_player_response = false;
+        break;
+
       default:
          wait_for_player_response = false;
         break;
    }
 }
 
+/// @brief Plays a random ringtone (MODE_RANDOM) when the player answers the count of files in the folder
+void playRandom() {
+  if (random_query == DFPLAYER_NO_HANDLE || !myDFPlayer.commandDone(random_query)) return;
+
+  int file_count = myDFPlayer.queryValue(random_query);
+  random_query = DFPLAYER_NO_HANDLE;
+
+  T("> queryFileCountsInFolder("); D(gong[NORMAL].folder); T(") = "); D(file_count); NL;
+  if (file_count > FILE_LAST) file_count = FILE_LAST;
+  gong[NORMAL].file = (file_count > 0) ? random(1, file_count + 1) : 1; // no answer - the file error is handled
+
+  T("> random file = "); D(gong[NORMAL].file); NL;
+
+  play(gong[NORMAL].folder, gong[NORMAL].file);
+}
+
+/// @brief Finishes the file error of STATUS_NEXT_FILE / STATUS_PREVIOUS_FILE when the player answers
+///        the count of files in the folder (usually at once - counted while the folder message played)
+void fileErrorCount() {
+  if (error_query == DFPLAYER_NO_HANDLE || !myDFPlayer.commandDone(error_query)) return;
+
+  int count = myDFPlayer.queryValue(error_query);
+  error_query = DFPLAYER_NO_HANDLE;
+
+  T("> queryFileCountsInFolder("); D(gong[gong_index].folder); T(") = "); D(count); NL;
+  status = STATUS_MESSAGE;
+  if (count < 1) { // empty folder or no answer
+    gong[gong_index].first = true;
+    gong[gong_index].file = 1;
+    play(FOLDER_MESSAGE, MESSAGE_FOLDER_EMPTY);
+  }
+  else if (error_status == STATUS_NEXT_FILE) {
+    gong[gong_index].last  = true;
+    gong[gong_index].first = false;
+    gong[gong_index].ready = true;
+    gong[gong_index].file--;
+    play(FOLDER_MESSAGE, MESSAGE_LAST_FILE_IN_FOLDER);
+  }
+  else {
+    play(FOLDER_MESSAGE, MESSAGE_FILE_SYSTEM_ERROR);
+  }
+}
+
+/// @brief Rings the players of the other zones and starts the ring latency measurement in all zones.
+///        The commands are only queued - the frames of the zones are sent in parallel by updateZones().
+void ringZones() {
+  for (uint8_t i = 0; i < ZONES; i++) {
+    struct Zone *zone = zones + i;
+    zone->ring_time = millis();
+    zone->ringing = true;
+    zone->play_handle = DFPLAYER_NO_HANDLE;
+    if (i == 0) continue; // zone 0 is played by playAction(), its handle is set by startClip()
+
+    zone->player->volume(zone->settings->volume);
+#ifdef LARGE_LIBRARY
+    zone->play_handle = zone->player->playLargeFolder(zone->settings->folder, zone->settings->file);
+#else
+    zone->play_handle = zone->player->playFolder(zone->settings->folder, zone->settings->file);
+#endif
+  }
+}
+
+/// @brief Receives the frames and sends the queued commands of the other zones (without waiting),
+///        measures the time from the ring to the first sound (BUSY LOW; to the ACK if the zone has no BUSY pin)
+void updateZones() {
+  for (uint8_t i = 0; i < ZONES; i++) {
+    struct Zone *zone = zones + i;
+    if (i > 0) {
+      while (zone->player->available()) zone->player->readType(); // events of the other zones are not used
+    }
+    if (!zone->ringing) continue;
+
+    bool sent = zone->play_handle != DFPLAYER_NO_HANDLE; // the BUSY of the previous ring is not this ring
+    uint8_t command_status = sent ? zone->player->commandStatus(zone->play_handle) : DFPLAYER_COMMAND_QUEUED;
+    bool sound = sent && ((zone->pin_busy != ZONE_NO_BUSY) ? !(*zone->busy_in & zone->busy_mask) : (command_status == DFPLAYER_COMMAND_DONE));
+    
+    if (sound) {
+      zone->ringing = false;
+      zone->latency = ((unsigned int) millis()) - zone->ring_time;
+      if (zone->latency > zone->latency_max) zone->latency_max = zone->latency;
+      if (zone->rings < 0xFFFF) zone->rings++;
+      T("> Zone "); D(i); T(" ring latency: "); D(zone->latency); T(" ms (max "); D(zone->latency_max); T(" ms)"); NL;
+    }
+    else if ((command_status == DFPLAYER_COMMAND_FAILED) || (command_status == DFPLAYER_COMMAND_ERROR) ||
+             (((unsigned int) millis()) - zone->ring_time > ZONE_RING_TIMEOUT)) {
+      zone->ringing = false;
+      if (zone->failures < 0xFFFF) zone->failures++;
+      T("> Zone "); D(i); T(" did not ring"); NL;
+    }
+  }
+}
+
 /// @brief Sets the next file in the current folder
 void nextFile() {
   const int local_gong_index = EDITED;
@@ -1011,6 +1679,16 @@ void nextFile() {
     gong[local_gong_index].file = 1;
   }
   else {
+    // the end of the folder is reported without a failed play, if the count of files is already known
+    int count = fileCount(gong[local_gong_index].folder);
+    if (((count > 0) && (gong[local_gong_index].file >= count)) || (gong[local_gong_index].file >= FILE_LAST)) {
+      gong[local_gong_index].first = false;
+      gong[local_gong_index].last = true;
+      gong[local_gong_index].ready = true;
+      
+      prompt(MESSAGE_LAST_FILE_IN_FOLDER);
+      return;
+    }
     gong[local_gong_index].file ++;
   }
 
@@ -1029,15 +1707,18 @@ void prevFile() {
   if (gong[local_gong_index].file == 1) {
     gong[local_gong_index].first = true;
 
-    status = STATUS_MESSAGE;
-
-    play(FOLDER_MESSAGE, MESSAGE_FIRST_FILE_IN_FOLDER);
+    prompt(MESSAGE_FIRST_FILE_IN_FOLDER);
   }
 
   else {
     if (!gong[local_gong_index].last) 
       gong[local_gong_index].file --;
     
+    // the folder has less files than the saved number (card changed) - go to the last file
+    int count = fileCount(gong[local_gong_index].folder);
+    if ((count > 0) && (gong[local_gong_index].file > count))
+      gong[local_gong_index].file = count;
+    
     gong[local_gong_index].last = false;
     gong[local_gong_index].ready = true;
 
@@ -1051,14 +1732,14 @@ void prevFile() {
 void prevFolder() { 
   const int local_gong_index = EDITED; 
 
-  if (gong[local_gong_index].folder <= 1) {
+  if (gong[local_gong_index].folder <= FOLDER_FIRST) {
     
-    gong[local_gong_index].folder = 1;
+    gong[local_gong_index].folder = FOLDER_FIRST;
     
   } 
-  else if (gong[local_gong_index].folder > 9) {
+  else if (gong[local_gong_index].folder > FOLDER_LAST) {
     
-    gong[local_gong_index].folder = 9;
+    gong[local_gong_index].folder = FOLDER_LAST;
 
   } 
   else {
@@ -1069,24 +1750,28 @@ void prevFolder() {
 
   gong[local_gong_index].file = 1;
   gong[local_gong_index].last = false;
-  gong[local_gong_index].first = true;
+  gong[local_gong_index].first = false; // the first file is previewed after the folder message
   gong[local_gong_index].ready = true;
 
+  fileCount(gong[local_gong_index].folder); // counted while the folder message is playing
   play(FOLDER_MESSAGE, gong[local_gong_index].folder - 1 + MESSAGE_FOLDER_1);
+  
+  // preview of the first ringtone right after the folder message (empty folder - file error, STATUS_NEXT_FILE)
+  queueClip(gong[local_gong_index].folder, gong[local_gong_index].file, STATUS_NEXT_FILE);
 }
 
 /// @brief Sets the previous folder in order
 void nextFolder() { 
   const int local_gong_index = EDITED; 
 
-  if (gong[local_gong_index].folder < 1) {
+  if (gong[local_gong_index].folder < FOLDER_FIRST) {
     
-    gong[local_gong_index].folder = 1;
+    gong[local_gong_index].folder = FOLDER_FIRST;
     
   } 
-  else if (gong[local_gong_index].folder >= 9) {
+  else if (gong[local_gong_index].folder >= FOLDER_LAST) {
     
-    gong[local_gong_index].folder = 9;
+    gong[local_gong_index].folder = FOLDER_LAST;
 
   } 
   else {
@@ -1097,58 +1782,56 @@ void nextFolder() {
 
   gong[local_gong_index].file = 1;
   gong[local_gong_index].last = false;
-  gong[local_gong_index].first = true;
+  gong[local_gong_index].first = false; // the first file is previewed after the folder message
   gong[local_gong_index].ready = true;
 
+  fileCount(gong[local_gong_index].folder); // counted while the folder message is playing
   play(FOLDER_MESSAGE, gong[local_gong_index].folder - 1 + MESSAGE_FOLDER_1);
+  
+  // preview of the first ringtone right after the folder message (empty folder - file error, STATUS_NEXT_FILE)
+  queueClip(gong[local_gong_index].folder, gong[local_gong_index].file, STATUS_NEXT_FILE);
 
 }
 
 /// @brief Sets volume up 
 void volumeUp() {
-  const int local_gong_index = EDITED;
-  int volume =  gong[local_gong_index].volume;
-  
-  stop();
-  
-  // Volume Up
-  volume += VOLUME_STEP;
-
-  // Correct
-  if (volume > VOLUME_MAX - VOLUME_STEP + 1) volume = VOLUME_MAX;
-  
-  // Set
-  myDFPlayer.volume(volume);
-  gong[local_gong_index].volume = volume;
-
-  // Play info
-
-  status = STATUS_MESSAGE;
-  play(FOLDER_MESSAGE, MESSAGE_VOLUME_SETTING);
-
+  volumeStep(VOLUME_STEP);
 }
 
 /// @brief Sets volume down
 void volumeDown(){
-  const int local_gong_index = EDITED;
-  int volume =  gong[local_gong_index].volume;
-  
-  stop();
+  volumeStep(-VOLUME_STEP);
+}
 
-  // Volume Up
-  volume -= VOLUME_STEP;
+/// @brief Changes the volume at once - also of the playing sound (no stop and replay).
+///        The volume message is deferred, see volumePrompt().
+/// @param step Volume change (negative - down)
+void volumeStep(int step) {
+  const int local_gong_index = EDITED;
+  int volume =  gong[local_gong_index].volume + step;
 
   // Correction of settings
-  if (volume < VOLUME_MIN + VOLUME_STEP - 1) volume = VOLUME_MIN;
+  if (volume > VOLUME_MAX) volume = VOLUME_MAX;
+  if (volume < VOLUME_MIN) volume = VOLUME_MIN;
   
-  // Set
+  // Set (sent only if the volume is changed)
   myDFPlayer.volume(volume);
   gong[local_gong_index].volume = volume;
+  T("> Volume "); D(volume); NL;
 
-  // Play info
-  status = STATUS_MESSAGE;
-  play(FOLDER_MESSAGE, MESSAGE_VOLUME_SETTING);
+  volume_changed = millis();
+  volume_prompt = (VOLUME_PROMPT_DELAY > 0);
+}
+
+/// @brief Plays the volume message VOLUME_PROMPT_DELAY after the last change - only if nothing is playing
+///        (otherwise the new volume is heard on the playing sound)
+void volumePrompt() {
+  if (!volume_prompt || chords.active()) return;
+  if (((unsigned int) millis()) - volume_changed < VOLUME_PROMPT_DELAY) return;
   
+  volume_prompt = false;
+  if (getBusy() || wait_for_player_response) return;
+  prompt(MESSAGE_VOLUME_SETTING);
 }
 
 /// @brief Saves settings to EEPROM
@@ -1187,7 +1870,7 @@ bool load() {
   adr += sizeof(data);
   EEPROM.get(adr, data2);
   
-  if ((data.file + data2.file == 0xFF) && (data.folder + data2.folder == 0xFF) && (data.mode + data2.mode == 0xFF) &&(data.volume + data2.volume == 0xFF)) {
+  if ((data.file + data2.file == 0xFFFF) && (data.folder + data2.folder == 0xFF) && (data.mode + data2.mode == 0xFF) &&(data.volume + data2.volume == 0xFF)) {
     gong[NORMAL] = data;  
     gong[NORMAL].first = false;
     gong[NORMAL].last  = false;
@@ -1202,9 +1885,7 @@ bool load() {
 
     init_gong();
     save();
-    status = STATUS_MESSAGE;
-    play(FOLDER_MESSAGE, MESSAGE_RESET_BELL);
-    delay(100);
+    // message MESSAGE_RESET_BELL is played when the player is online (playerOnline())
   }
 
   return return_value;
@@ -0,0 +1,468 @@
+/*
+ * DFPlayer parser benchmark and fuzz suite
+ *
+ * Host-side (Linux) throughput and robustness test of the DFRobotDFPlayerMini frame parser.
+ *
+ * file   : dfplayer-bench.cpp
+ *
+ *   The frames are fed to available() through a memory-backed Stream (and through
+ *   DFPlayerDriver<DFPlayerHostTransport> for comparison):
+ *
+ *     clean      - valid frames
+ *     noise      - frames with bit flips, dropped and inserted bytes
+ *     truncated  - frames cut at a random length, followed by a valid frame
+ *     fuzz       - random and adversarial inputs (headers, mutated frames), byte by byte
+ *     handles    - status and value of the command handles (skipped settings, cached and pending queries)
+ *
+ *   Reported: bytes/s, frames/s, time per frame, the recovered and the spurious frames. After every
+ *   call the parser is checked: the incomplete frame must fit in _received[] and the guard
+ *   words around the player object must be untouched. Crashes and out-of-bounds accesses
+ *   are reported by the sanitizers (see README.md).
+ *
+ *   Usage: dfplayer-bench [frames] [fuzz inputs] [seed]
+ */
+
+#include "DFRobotDFPlayerMini.h"
+#include "DFPlayerDriver.h"
+#include "DFPlayerHostTransport.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define CHUNK 32               // bytes received between two available() calls
+#define GUARD 0xA5A5A5A5u      // guard word around the player
+
+typedef std::vector<uint8_t> Bytes;
+
+/// @brief Memory-backed Stream; available() returns at most CHUNK bytes per refill()
+class MemoryStream : public Stream {
+  public:
+    MemoryStream(const Bytes &data, size_t chunk) : _data(data), _chunk(chunk) {}
+
+    void refill() { _left = _chunk; }
+    bool done() { return _position >= _data.size(); }
+
+    int available() {
+      size_t rest = _data.size() - _position;
+      return (int)(rest < _left ? rest : _left);
+    }
+    int read() {
+      if (!available()) return -1;
+      _left--;
+      return _data[_position++];
+    }
+    int peek() { return available() ? _data[_position] : -1; }
+    size_t write(uint8_t) { return 1; } // commands of the player are not sent in the benchmark
+
+  private:
+    const Bytes &_data;
+    size_t _chunk;
+    size_t _position = 0;
+    size_t _left = 0;
+};
+
+/// @brief Player surrounded by guard words - a write beyond the object damages them
+struct GuardedPlayer {
+  uint32_t before[4] = {GUARD, GUARD, GUARD, GUARD};
+  DFRobotDFPlayerMini player;
+  uint32_t after[4] = {GUARD, GUARD, GUARD, GUARD};
+
+  bool intact() {
+    for (int i = 0; i < 4; i++) {
+      if (before[i] != GUARD || after[i] != GUARD) return false;
+    }
+    return true;
+  }
+};
+
+static std::mt19937 rng;
+static unsigned long failures = 0;
+
+static int random(int from, int to) {
+  return std::uniform_int_distribution<int>(from, to)(rng);
+}
+
+/// @brief Appends the frame with a valid checksum
+static void appendFrame(Bytes &out, uint8_t command, uint16_t parameter) {
+  uint8_t frame[DFPLAYER_RECEIVED_LENGTH] = {0x7E, 0xFF, 0x06, command, 0x00, (uint8_t)(parameter >> 8), (uint8_t)parameter, 0, 0, 0xEF};
+  uint16_t sum = 0;
+  for (int i = Stack_Version; i < Stack_CheckSum; i++) sum += frame[i];
+  sum = -sum;
+  frame[Stack_CheckSum] = sum >> 8;
+  frame[Stack_CheckSum + 1] = sum;
+  out.insert(out.end(), frame, frame + DFPLAYER_RECEIVED_LENGTH);
+}
+
+/// @brief Random frame of the player: events, ACK, errors, query replies
+static void appendRandomFrame(Bytes &out) {
+  static const uint8_t commands[] = {0x3D, 0x3C, 0x3E, 0x40, 0x41, 0x42, 0x43, 0x48, 0x4E};
+  appendFrame(out, commands[random(0, sizeof(commands) - 1)], random(0, 0xFFFF));
+}
+
+/// @brief Checks the parser state after a call
+static bool check(GuardedPlayer &guarded, const char *scenario) {
+  if (guarded.player.receivedLength() >= DFPLAYER_RECEIVED_LENGTH || !guarded.intact()) {
+    printf("!!! %s: parser out of bounds (received length %d, guards %s)\n", scenario,
+           guarded.player.receivedLength(), guarded.intact() ? "ok" : "DAMAGED");
+    failures++;
+    return false;
+  }
+  return true;
+}
+
+/// @brief Counters of a run (DFPlayerStats saturate at 0xFFFF - collected and cleared regularly)
+struct Totals {
+  unsigned long frames = 0;
+  unsigned long errors = 0;
+  unsigned long resyncs = 0;
+
+  void collect(DFRobotDFPlayerMini &player) {
+    DFPlayerStats stats = player.stats();
+    frames += stats.framesReceived;
+    errors += stats.headerErrors + stats.lengthErrors + stats.endErrors + stats.checkSumErrors;
+    resyncs += stats.resyncs;
+    player.clearStats();
+  }
+};
+
+/// @brief Valid injected frames delivered by the parser and the frames made of the damaged ones
+struct Recovery {
+  unsigned long injected = 0;  // valid frames in the stream
+  unsigned long recovered = 0; // valid frames delivered
+  unsigned long spurious = 0;  // delivered frames that were not injected as valid
+
+  /// @brief Stream without damaged frames - every delivered frame up to the injected ones is valid
+  static Recovery clean(unsigned long injected, unsigned long frames) {
+    Recovery recovery;
+    recovery.injected = injected;
+    recovery.recovered = frames < injected ? frames : injected;
+    recovery.spurious = frames - recovery.recovered;
+    return recovery;
+  }
+};
+
+/// @brief Prints one line of the report
+static void report(const char *scenario, size_t bytes, const Totals &totals, const Recovery &recovery, double seconds) {
+  printf("%-10s %9zu B %8lu frames %6.1f %% recovered %5lu spurious  %10.0f B/s %10.0f frames/s %7.1f ns/frame  errors %lu, resyncs %lu\n",
+         scenario, bytes, totals.frames, recovery.injected ? 100.0 * recovery.recovered / recovery.injected : 100.0, recovery.spurious,
+         bytes / seconds, totals.frames / seconds, totals.frames ? seconds * 1e9 / totals.frames : 0.0,
+         totals.errors, totals.resyncs);
+}
+
+/// @brief Feeds the stream to available() and reports the throughput
+/// @param recovery Recovered frames of the scenario, nullptr - a clean stream of expected frames
+static void run(const char *scenario, const Bytes &data, unsigned long expected, const Recovery *recovery = nullptr) {
+  GuardedPlayer *guarded = new GuardedPlayer; // on the heap - checked by AddressSanitizer
+  MemoryStream stream(data, CHUNK);
+  Totals totals;
+  guarded->player.begin(stream, true, false);
+  guarded->player.clearStats();
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long calls = 1; !stream.done(); calls++) {
+    stream.refill();
+    guarded->player.available();
+    guarded->player.readType(); // the event was read - the next one can be reported
+    if (!check(*guarded, scenario)) break;
+    if (!(calls % 1024)) totals.collect(guarded->player);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  totals.collect(guarded->player);
+  report(scenario, data.size(), totals, recovery ? *recovery : Recovery::clean(expected, totals.frames), seconds);
+  delete guarded;
+}
+
+/// @brief The same clean stream through the templated driver (no virtual calls)
+static void runDriver(const Bytes &data) {
+  DFPlayerHostTransport transport;
+  DFPlayerDriver<DFPlayerHostTransport> *player = new DFPlayerDriver<DFPlayerHostTransport>;
+
+  Totals totals;
+  player->begin(transport, true, false);
+  player->clearStats();
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t position = 0; position < data.size(); position += CHUNK) {
+    transport.feed(data.data() + position, data.size() - position < CHUNK ? data.size() - position : CHUNK);
+    player->available();
+    player->readType();
+    if (!((position / CHUNK + 1) % 1024)) totals.collect(*player);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  totals.collect(*player);
+  report("driver<>", data.size(), totals, Recovery::clean(data.size() / DFPLAYER_RECEIVED_LENGTH, totals.frames), seconds);
+  delete player;
+}
+
+/// @brief Damages the frame by a bit flip, a dropped or an inserted byte
+static void addNoise(Bytes &frame) {
+  size_t position = random(0, frame.size() - 1);
+  switch (random(0, 2)) {
+    case 0: frame[position] ^= 1 << random(0, 7); break;
+    case 1: frame.erase(frame.begin() + position); break;
+    case 2: frame.insert(frame.begin() + position, (uint8_t)random(0, 255)); break;
+  }
+}
+
+/// @brief Cuts the frame at a random length
+static void truncate(Bytes &frame) {
+  frame.resize(frame.size() - random(1, 9));
+}
+
+/// @brief Frame damaged by a bit flip, a dropped or an inserted byte
+static void appendNoisyFrame(Bytes &out) {
+  Bytes frame;
+  appendRandomFrame(frame);
+  addNoise(frame);
+  out.insert(out.end(), frame.begin(), frame.end());
+}
+
+/// @brief Measures the recovery of a stream with 5 % damaged frames (not timed). The valid frames are
+///        play finished events (0x3D) tagged by their number, the damaged ones have bit 15 of the tag set -
+///        the delivered events are matched to the injected frames, the other delivered frames are spurious.
+static Recovery recover(unsigned long frames, void (*damage)(Bytes &frame)) {
+  Bytes data;
+  Recovery recovery;
+  for (unsigned long i = 0; i < frames; i++) {
+    Bytes frame;
+    if (random(0, 99) < 5) {
+      appendFrame(frame, 0x3D, 0x8000 | random(0, 0x7FFF));
+      damage(frame);
+    }
+    else {
+      appendFrame(frame, 0x3D, recovery.injected++ & 0x7FFF);
+    }
+    data.insert(data.end(), frame.begin(), frame.end());
+  }
+
+  GuardedPlayer *guarded = new GuardedPlayer;
+  MemoryStream stream(data, DFPLAYER_RECEIVED_LENGTH); // at most two events per call - none is lost in the event ring
+  Totals totals;
+  unsigned long next = 0; // first injected frame not delivered yet
+  guarded->player.begin(stream, true, false);
+  guarded->player.clearStats();
+
+  for (unsigned long calls = 1; !stream.done(); calls++) {
+    stream.refill();
+    while (guarded->player.available()) {
+      uint8_t type = guarded->player.readType();
+      uint16_t tag = guarded->player.read();
+      if (type != DFPlayerPlayFinished || (tag & 0x8000)) continue;
+      unsigned long index = next + ((tag - next) & 0x7FFF); // delivered in order, a few lost before it
+      if (index < next + 16 && index < recovery.injected) {
+        recovery.recovered++;
+        next = index + 1;
+      }
+    }
+    if (!(calls % 1024)) totals.collect(guarded->player);
+  }
+  totals.collect(guarded->player);
+  recovery.spurious = totals.frames - recovery.recovered;
+  delete guarded;
+  return recovery;
+}
+
+/// @brief Adversarial input: random bytes, header fragments, mutated frames
+static Bytes fuzzInput() {
+  Bytes input;
+  int parts = random(1, 8);
+  for (int i = 0; i < parts; i++) {
+    switch (random(0, 4)) {
+      case 0: // random bytes
+        for (int n = random(1, 32); n > 0; n--) input.push_back(random(0, 255));
+        break;
+      case 1: // header candidates
+        for (int n = random(1, 12); n > 0; n--) {
+          static const uint8_t header[] = {0x7E, 0xFF, 0x06};
+          input.insert(input.end(), header, header + random(1, 3));
+        }
+        break;
+      case 2: // frame with several damaged bytes
+        appendRandomFrame(input);
+        for (int n = random(1, 4); n > 0; n--) input[input.size() - 1 - random(0, 9)] = random(0, 255);
+        break;
+      case 3: // truncated frame
+        appendRandomFrame(input);
+        input.resize(input.size() - random(1, 9));
+        break;
+      default:
+        appendRandomFrame(input);
+        break;
+    }
+  }
+  return input;
+}
+
+/// @brief Feeds the input byte by byte and through available(), checks the parser after every byte
+static bool fuzzOne(const uint8_t *data, size_t size) {
+  GuardedPlayer *guarded = new GuardedPlayer;
+  Bytes input(data, data + size);
+  MemoryStream stream(input, 1);
+  guarded->player.begin(stream, true, false);
+
+  bool ok = true;
+  while (ok && !stream.done()) {
+    stream.refill();
+    guarded->player.available();
+    guarded->player.readType();
+    ok = check(*guarded, "fuzz");
+  }
+  for (size_t i = 0; ok && i < size; i++) { // directly, as from the interrupt
+    guarded->player.receiveByte(data[i]);
+    ok = check(*guarded, "fuzz");
+  }
+  delete guarded;
+  return ok;
+}
+
+/// @brief Result of one handle check
+static bool expect(bool condition, const char *check) {
+  if (!condition) {
+    printf("!!! handles: %s\n", check);
+    failures++;
+  }
+  return condition;
+}
+
+/// @brief Feeds one valid frame of the player and processes it
+static void receive(DFRobotDFPlayerMini &player, uint8_t command, uint16_t parameter) {
+  Bytes frame;
+  appendFrame(frame, command, parameter);
+  for (uint8_t b : frame) player.receiveByte(b);
+  while (player.available()) player.readType();
+}
+
+/// @brief Every handle returned by the driver reports its own status and value
+static bool checkHandles() {
+  unsigned long before = failures;
+  Bytes none;
+  MemoryStream stream(none, CHUNK);
+  DFRobotDFPlayerMini *player = new DFRobotDFPlayerMini;
+  player->begin(stream, true, false);
+
+  // settings not sent - the player is already set
+  uint8_t volume = player->volume(20);
+  receive(*player, 0x41, 0);
+  uint8_t eq = player->EQ(DFPLAYER_EQ_ROCK);
+  receive(*player, 0x41, 0);
+  uint8_t volumeAgain = player->volume(20);
+  uint8_t eqAgain = player->EQ(DFPLAYER_EQ_ROCK);
+  expect(player->commandStatus(volume) == DFPLAYER_COMMAND_DONE, "volume() acknowledged");
+  expect(player->commandStatus(eq) == DFPLAYER_COMMAND_DONE, "EQ() acknowledged");
+  expect(player->commandStatus(volumeAgain) == DFPLAYER_COMMAND_DONE, "volume() skipped");
+  expect(player->commandStatus(eqAgain) == DFPLAYER_COMMAND_DONE, "EQ() skipped after volume()");
+
+  // cached query - every handle of the entry reads the value
+  uint8_t first = player->queryFileCountsInFolder(3);
+  receive(*player, 0x41, 0);
+  receive(*player, 0x4E, 7);
+  uint8_t second = player->queryFileCountsInFolder(3); // from the cache
+  uint8_t other = player->queryFileCountsInFolder(4);
+  receive(*player, 0x41, 0);
+  receive(*player, 0x4E, 12);
+  uint8_t third = player->queryFileCountsInFolder(3);
+  expect(player->queryValue(first) == 7, "first handle of the cached query");
+  expect(player->queryValue(second) == 7, "second handle of the cached query");
+  expect(player->queryValue(third) == 7, "third handle of the cached query");
+  expect(player->commandDone(first) && player->commandStatus(second) == DFPLAYER_COMMAND_DONE, "status of the cached query");
+  expect(player->queryValue(other) == 12, "query of another folder");
+
+  // error instead of the reply of the acknowledged query - the query fails at once, no error event
+  uint8_t missing = player->queryFileCountsInFolder(9);
+  receive(*player, 0x41, 0);
+  receive(*player, 0x40, FileIndexOut);
+  expect(player->commandStatus(missing) == DFPLAYER_COMMAND_ERROR, "error answer of the pending query");
+  expect(player->stats().queryTimeouts == 0, "pending query failed by the error, not by the timeout");
+
+  // error after the acknowledged play command belongs to the play command (file error event)
+  player->queryFileCountsInFolder(8);
+  receive(*player, 0x41, 0);
+  player->playFolder(8, 1);
+  receive(*player, 0x41, 0);
+  Bytes frame;
+  appendFrame(frame, 0x40, FileIndexOut);
+  for (uint8_t b : frame) player->receiveByte(b);
+  bool event = player->available() && (player->readType() == DFPlayerError);
+  expect(event, "file error of the play command reported as an event");
+
+  // the handles wrap - a held handle is not given to a new command
+  bool aliased = false;
+  for (int i = 0; i < 600; i++) {
+    uint8_t handle = player->volumeUp();
+    receive(*player, 0x41, 0);
+    aliased |= (handle == first) || (handle == other);
+  }
+  expect(!aliased, "new handle equal to a cached one");
+  expect(player->queryValue(first) == 7 && player->queryValue(other) == 12, "cached handles after the wrap");
+
+  delete player;
+  return failures == before;
+}
+
+#ifdef DFPLAYER_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  if (!fuzzOne(data, size)) abort();
+  return 0;
+}
+
+#else
+
+int main(int argc, char **argv) {
+  unsigned long frames = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+  unsigned long inputs = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20000;
+  rng.seed(argc > 3 ? strtoul(argv[3], nullptr, 10) : 1);
+
+  Bytes clean, noise, truncated;
+  for (unsigned long i = 0; i < frames; i++) appendRandomFrame(clean);
+
+  for (unsigned long i = 0; i < frames; i++) {
+    if (random(0, 99) < 5) {
+      appendNoisyFrame(noise); // 5 % damaged frames
+    }
+    else {
+      appendRandomFrame(noise);
+    }
+  }
+
+  for (unsigned long i = 0; i < frames; i++) {
+    appendRandomFrame(truncated);
+    if (random(0, 99) < 5) {
+      truncated.resize(truncated.size() - random(1, 9));
+    }
+  }
+
+  Recovery noiseRecovery = recover(frames, addNoise);
+  Recovery truncatedRecovery = recover(frames, truncate);
+
+  printf("DFPlayer parser benchmark: %lu frames per scenario, %d bytes per available() call\n\n", frames, CHUNK);
+  run("clean", clean, frames);
+  run("noise", noise, 0, &noiseRecovery);
+  run("truncated", truncated, 0, &truncatedRecovery);
+  runDriver(clean);
+
+  unsigned long bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < inputs; i++) {
+    Bytes input = fuzzInput();
+    bytes += input.size();
+    if (!fuzzOne(input.data(), input.size())) {
+      printf("!!! fuzz input %lu:", i);
+      for (uint8_t b : input) printf(" %02X", b);
+      printf("\n");
+      break;
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("\nfuzz: %lu inputs, %lu bytes, %.2f s - %s\n", inputs, bytes, seconds, failures ? "FAILED" : "OK");
+  printf("handles: %s\n", checkHandles() ? "OK" : "FAILED");
+
+  return failures ? 1 : 0;
+}
+
+#endif
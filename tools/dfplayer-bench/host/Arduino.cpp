@@ -0,0 +1,22 @@
+/*
+ * Arduino.cpp for the host
+ *
+ * millis() and delay() on Linux.
+ *
+ * file   : Arduino.cpp
+ */
+
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
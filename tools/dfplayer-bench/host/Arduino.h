@@ -0,0 +1,48 @@
+/*
+ * Arduino.h for the host
+ *
+ * Minimal Arduino API for compiling DFRobotDFPlayerMini on Linux.
+ *
+ * file   : Arduino.h
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define memcpy_P memcpy
+#define F(text) text
+
+#define HEX 16
+#define DEC 10
+
+unsigned long millis();
+void delay(unsigned long ms);
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t data) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+#endif
@@ -0,0 +1,633 @@
+/*
+ * DFPlayer Mini emulator
+ *
+ * Host-side (Linux) stand-in for the DFPlayer Mini - DFR0299.
+ *
+ * file   : dfplayer-emulator.cpp
+ *
+ *   Speaks the serial frame format of DFRobotDFPlayerMini:
+ *
+ *       7E FF 06 cmd ack paramH paramL checkH checkL EF
+ *
+ *   over a pseudo-terminal (or a real serial port), simulates a folder tree of the
+ *   microSD card, answers the ACK (0x41), the queries (0x42 - 0x4F), reports the end
+ *   of playback (0x3D), errors (0x40) and card events (0x3A, 0x3B, 0x3F) and simulates
+ *   the BUSY output. The timing of the replies follows a configurable latency model.
+ *
+ *   Build:
+ *          g++ -std=c++17 -O2 -Wall -o dfplayer-emulator dfplayer-emulator.cpp
+ *
+ *   Usage: see README.md
+ */
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define FRAME_LENGTH 10
+
+// error codes of the 0x40 frame (DFRobotDFPlayerMini.h)
+#define ERROR_BUSY 1
+#define ERROR_SLEEPING 2
+#define ERROR_SERIAL_WRONG_STACK 3
+#define ERROR_CHECKSUM 4
+#define ERROR_FILE_INDEX_OUT 5
+#define ERROR_FILE_MISMATCH 6
+
+#define STATE_STOPPED 0
+#define STATE_PLAYING 1
+#define STATE_PAUSED 2
+
+typedef std::chrono::steady_clock Clock;
+
+/// @brief Latency model and other options of the emulator
+struct Options {
+  long seek = 40;          // SD seek delay in ms - file start and queries of the card
+  long ackDelay = 5;       // delay of the ACK in ms
+  long jitter = 10;        // random reply jitter 0..jitter ms
+  long track = 3000;       // length of the played file in ms
+  long resetDelay = 1500;  // time of the reset (card initialization) in ms
+  double drop = 0;         // probability of a dropped byte (both directions)
+  double corrupt = 0;      // probability of a corrupted byte (both directions)
+  unsigned seed = 1;       // random generator seed
+  std::string device;      // serial port instead of the pty, RTS is the BUSY output
+  std::string link;        // symlink to the pty
+  bool verbose = false;    // log all bytes
+};
+
+static Options options;
+static std::mt19937 rng;
+static Clock::time_point start;
+
+static int port = -1;      // pty master or serial port
+static bool realPort = false;
+
+// card: folder -> set of file numbers
+static std::map<int, std::set<int>> tree;
+static bool cardInserted = true;
+
+// player state
+static int state = STATE_STOPPED;
+static int volume = 30;
+static int eq = 0;
+static int device = 2;
+static bool sleeping = false;
+static bool loopFile = false;
+static int currentFolder = 0;
+static int currentFile = 0;
+static int currentIndex = 0;   // global file number
+static unsigned playGeneration = 0;
+static bool busy = false;
+
+// scheduled actions
+static std::multimap<Clock::time_point, std::function<void()>> timeline;
+static Clock::time_point lastTx;
+
+// received frame
+static uint8_t received[FRAME_LENGTH];
+static int receivedIndex = 0;
+static Clock::time_point receivedTime;
+
+/// @brief Milliseconds since the start of the emulator
+static long now() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+/// @brief Logs a line with the timestamp
+static void logLine(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static void logLine(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf("%8ld ms  ", now());
+  vprintf(format, args);
+  printf("\n");
+  fflush(stdout);
+  va_end(args);
+}
+
+/// @brief Returns true with the probability p
+static bool chance(double p) {
+  return (p > 0) && (std::uniform_real_distribution<double>(0, 1)(rng) < p);
+}
+
+/// @brief Random jitter 0..options.jitter ms
+static long jitter() {
+  return options.jitter > 0 ? std::uniform_int_distribution<long>(0, options.jitter)(rng) : 0;
+}
+
+/// @brief Schedules an action after the delay
+static void schedule(long delay, std::function<void()> action) {
+  timeline.emplace(Clock::now() + std::chrono::milliseconds(delay), action);
+}
+
+////////////////////////////////// CARD ///////////////////////////////////
+
+/// @brief Total count of files on the card
+static int fileCount() {
+  int count = 0;
+  for (auto &folder : tree) count += folder.second.size();
+  return count;
+}
+
+/// @brief Global file number (order of files on the card), 0 - file not found
+static int fileIndex(int folder, int file) {
+  int index = 0;
+  for (auto &f : tree) {
+    for (int n : f.second) {
+      index++;
+      if (f.first == folder && n == file) return index;
+    }
+  }
+  return 0;
+}
+
+/// @brief Finds the file by its global number
+static bool fileByIndex(int index, int &folder, int &file) {
+  for (auto &f : tree) {
+    for (int n : f.second) {
+      if (--index == 0) {
+        folder = f.first;
+        file = n;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/// @brief Parses the folder specification "folder:files", files e.g. "1-9,20,30-32"
+static bool parseFolder(const char *spec) {
+  char *end;
+  long folder = strtol(spec, &end, 10);
+  if (*end != ':' || folder < 0 || folder > 99) return false;
+  std::set<int> &files = tree[folder];
+  const char *p = end + 1;
+  while (*p) {
+    long from = strtol(p, &end, 10);
+    long to = from;
+    if (end == p) return false;
+    if (*end == '-') {
+      p = end + 1;
+      to = strtol(p, &end, 10);
+      if (end == p) return false;
+    }
+    for (long n = from; n <= to && n <= 3000; n++) files.insert(n);
+    p = (*end == ',') ? end + 1 : end;
+    if (*end && *end != ',') return false;
+  }
+  return true;
+}
+
+////////////////////////////////// OUTPUT ///////////////////////////////////
+
+/// @brief Sets the BUSY output (LOW - playing); on a serial port the RTS line is asserted while playing
+static void setBusy(bool playing) {
+  if (busy == playing) return;
+  busy = playing;
+  logLine("BUSY %s", playing ? "LOW (playing)" : "HIGH");
+  if (realPort) {
+    int rts = TIOCM_RTS;
+    ioctl(port, playing ? TIOCMBIS : TIOCMBIC, &rts);
+  }
+}
+
+/// @brief Writes one byte to the port, applies the drop / corrupt model
+static void writeByte(uint8_t data) {
+  if (chance(options.drop)) {
+    logLine("TX byte %02X dropped", data);
+    return;
+  }
+  if (chance(options.corrupt)) {
+    uint8_t damaged = data ^ (1 << std::uniform_int_distribution<int>(0, 7)(rng));
+    logLine("TX byte %02X corrupted to %02X", data, damaged);
+    data = damaged;
+  }
+  if (write(port, &data, 1) != 1 && options.verbose) logLine("TX write error: %s", strerror(errno));
+}
+
+/// @brief Sends the frame to the driver after the delay; frames keep their order and the 9600 Bd timing
+static void sendFrame(uint8_t command, uint16_t parameter, long delay) {
+  uint8_t frame[FRAME_LENGTH] = {0x7E, 0xFF, 0x06, command, 0x00, (uint8_t)(parameter >> 8), (uint8_t)parameter, 0, 0, 0xEF};
+  uint16_t sum = 0;
+  for (int i = 1; i < 7; i++) sum += frame[i];
+  sum = -sum;
+  frame[7] = sum >> 8;
+  frame[8] = sum;
+
+  Clock::time_point at = Clock::now() + std::chrono::milliseconds(delay);
+  Clock::time_point free = lastTx + std::chrono::microseconds(FRAME_LENGTH * 1042); // 10 bits per byte
+  if (at < free) at = free;
+  lastTx = at;
+
+  Clock::time_point request = receivedTime;
+  timeline.emplace(at, [=]() {
+    long latency = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - request).count();
+    logLine("TX %02X %04X  (%ld ms after the last request)", command, parameter, latency);
+    for (int i = 0; i < FRAME_LENGTH; i++) writeByte(frame[i]);
+  });
+}
+
+////////////////////////////////// PLAYBACK ///////////////////////////////////
+
+/// @brief Stops the playback (pending end of the file is cancelled)
+static void stopPlayback() {
+  playGeneration++;
+  state = STATE_STOPPED;
+  setBusy(false);
+}
+
+/// @brief Schedules the end of the played file
+static void scheduleEnd(long delay) {
+  unsigned generation = playGeneration;
+  schedule(delay, [=]() {
+    if (generation != playGeneration || state != STATE_PLAYING) return;
+    if (loopFile) {
+      scheduleEnd(options.track);
+      return;
+    }
+    logLine("end of file %02d/%03d (%d)", currentFolder, currentFile, currentIndex);
+    state = STATE_STOPPED;
+    setBusy(false);
+    sendFrame(0x3D, currentIndex, 0);
+  });
+}
+
+/// @brief Starts playing the file after the SD seek delay, or reports the error
+static void startPlayback(int folder, int file) {
+  stopPlayback();
+  long seek = options.seek + jitter();
+
+  if (!cardInserted) {
+    sendFrame(0x40, ERROR_FILE_INDEX_OUT, seek);
+    return;
+  }
+  int index = fileIndex(folder, file);
+  if (!index) {
+    logLine("file %02d/%03d not found", folder, file);
+    sendFrame(0x40, ERROR_FILE_MISMATCH, seek);
+    return;
+  }
+
+  unsigned generation = playGeneration;
+  schedule(seek, [=]() {
+    if (generation != playGeneration) return;
+    currentFolder = folder;
+    currentFile = file;
+    currentIndex = index;
+    state = STATE_PLAYING;
+    logLine("playing file %02d/%03d (%d)", folder, file, index);
+    setBusy(true);
+    scheduleEnd(options.track);
+  });
+}
+
+/// @brief Starts playing the file by its global number
+static void startPlaybackIndex(int index) {
+  int folder, file;
+  if (fileByIndex(index, folder, file)) {
+    startPlayback(folder, file);
+  }
+  else {
+    stopPlayback();
+    sendFrame(0x40, ERROR_FILE_INDEX_OUT, options.seek + jitter());
+  }
+}
+
+/// @brief Resets the player; after the initialization it reports the card
+static void resetPlayer() {
+  stopPlayback();
+  volume = 30;
+  eq = 0;
+  device = 2;
+  sleeping = false;
+  loopFile = false;
+  if (cardInserted) sendFrame(0x3F, 0x02, options.resetDelay + jitter());
+}
+
+////////////////////////////////// COMMANDS ///////////////////////////////////
+
+/// @brief Executes the received command; returns false if the command is unknown
+static bool execute(uint8_t command, uint16_t parameter) {
+  long reply = options.ackDelay + options.seek + jitter(); // queries read the card
+
+  switch (command) {
+    case 0x01: startPlaybackIndex(currentIndex < fileCount() ? currentIndex + 1 : 1); break;
+    case 0x02: startPlaybackIndex(currentIndex > 1 ? currentIndex - 1 : fileCount()); break;
+    case 0x03: startPlaybackIndex(parameter); break;
+    case 0x04: if (volume < 30) volume++; break;
+    case 0x05: if (volume > 0) volume--; break;
+    case 0x06: volume = parameter > 30 ? 30 : parameter; break;
+    case 0x07: eq = parameter; break;
+    case 0x08: startPlaybackIndex(parameter); loopFile = true; break;
+    case 0x09: device = parameter; break;
+    case 0x0A: sleeping = true; stopPlayback(); break;
+    case 0x0C: resetPlayer(); break;
+    case 0x0D:
+      if (state == STATE_PAUSED) {
+        state = STATE_PLAYING;
+        setBusy(true);
+        scheduleEnd(options.track);
+      }
+      break;
+    case 0x0E:
+      if (state == STATE_PLAYING) {
+        playGeneration++;
+        state = STATE_PAUSED;
+        setBusy(false);
+      }
+      break;
+    case 0x0F: startPlayback(parameter >> 8, parameter & 0xFF); break;
+    case 0x10: break;
+    case 0x11: loopFile = false; startPlaybackIndex(1); break;
+    case 0x12: startPlayback(0, parameter); break;                          // folder "mp3" is folder 0
+    case 0x13: break;                                                       // advertisement is not simulated
+    case 0x14: startPlayback(parameter >> 12, parameter & 0x0FFF); break;
+    case 0x15: break;
+    case 0x16: stopPlayback(); break;
+    case 0x17: startPlayback(parameter, 1); break;
+    case 0x18: startPlaybackIndex(std::uniform_int_distribution<int>(1, fileCount() ? fileCount() : 1)(rng)); break;
+    case 0x19: loopFile = !parameter; break;
+    case 0x1A: break;
+    case 0x42: sendFrame(0x42, state, reply); break;
+    case 0x43: sendFrame(0x43, volume, reply); break;
+    case 0x44: sendFrame(0x44, eq, reply); break;
+    case 0x47:
+    case 0x49: sendFrame(command, 0, reply); break;                        // U-disk, flash - empty
+    case 0x48: sendFrame(0x48, fileCount(), reply); break;
+    case 0x4B:
+    case 0x4D: sendFrame(command, 0, reply); break;
+    case 0x4C: sendFrame(0x4C, currentIndex, reply); break;
+    case 0x4E:
+      if (tree.count(parameter)) sendFrame(0x4E, tree[parameter].size(), reply);
+      else sendFrame(0x40, ERROR_FILE_INDEX_OUT, reply);
+      break;
+    case 0x4F: sendFrame(0x4F, tree.size() - tree.count(0), reply); break;
+    default:
+      return false;
+  }
+  return true;
+}
+
+/// @brief Handles one validated frame from the driver
+static void handleFrame() {
+  uint8_t command = received[3];
+  uint16_t parameter = (received[5] << 8) | received[6];
+  bool ack = received[4];
+
+  logLine("RX %02X %04X%s", command, parameter, ack ? "  ack" : "");
+
+  if (sleeping && command != 0x09 && command != 0x0C && command != 0x0B) { // only wake up commands
+    sendFrame(0x40, ERROR_SLEEPING, options.ackDelay);
+    return;
+  }
+  if (command == 0x0B || (command == 0x09 && sleeping)) sleeping = false;
+
+  if (ack) sendFrame(0x41, 0, options.ackDelay + jitter()); // the ACK goes before the reply
+
+  if (!execute(command, parameter) && command != 0x0B) {
+    logLine("unknown command %02X", command);
+  }
+}
+
+/// @brief Assembles the frame from the received bytes
+static void receiveByte(uint8_t data) {
+  if (chance(options.drop)) {
+    logLine("RX byte %02X dropped", data);
+    return;
+  }
+  if (chance(options.corrupt)) {
+    uint8_t damaged = data ^ (1 << std::uniform_int_distribution<int>(0, 7)(rng));
+    logLine("RX byte %02X corrupted to %02X", data, damaged);
+    data = damaged;
+  }
+  if (options.verbose) logLine("rx %02X", data);
+
+  if (receivedIndex == 0) {
+    if (data == 0x7E) {
+      received[receivedIndex++] = data;
+      receivedTime = Clock::now();
+    }
+    return;
+  }
+  received[receivedIndex++] = data;
+
+  if ((receivedIndex == 2 && data != 0xFF) || (receivedIndex == 3 && data != 0x06)) {
+    receivedIndex = 0;
+    sendFrame(0x40, ERROR_SERIAL_WRONG_STACK, options.ackDelay);
+    return;
+  }
+  if (receivedIndex < FRAME_LENGTH) return;
+  receivedIndex = 0;
+
+  uint16_t sum = 0;
+  for (int i = 1; i < 7; i++) sum += received[i];
+  if (received[9] != 0xEF) {
+    sendFrame(0x40, ERROR_SERIAL_WRONG_STACK, options.ackDelay);
+  }
+  else if ((uint16_t)-sum != ((received[7] << 8) | received[8])) {
+    logLine("RX checksum error");
+    sendFrame(0x40, ERROR_CHECKSUM, options.ackDelay);
+  }
+  else {
+    handleFrame();
+  }
+}
+
+////////////////////////////////// CONSOLE ///////////////////////////////////
+
+/// @brief Executes the console command (stdin)
+static bool console(char *line) {
+  char word[16] = "";
+  int value = 0;
+  int count = sscanf(line, "%15s %i", word, &value);
+  if (count < 1) return true;
+
+  if (!strcmp(word, "remove")) {
+    cardInserted = false;
+    stopPlayback();
+    sendFrame(0x3B, 0x02, 0);
+  }
+  else if (!strcmp(word, "insert")) {
+    cardInserted = true;
+    sendFrame(0x3A, 0x02, 0);
+  }
+  else if (!strcmp(word, "finish")) {
+    if (state == STATE_PLAYING) {
+      loopFile = false;
+      scheduleEnd(0);
+    }
+  }
+  else if (!strcmp(word, "error") && count == 2) {
+    sendFrame(0x40, value, 0);
+  }
+  else if (!strcmp(word, "send") && count == 2) {
+    sendFrame(value >> 16, value & 0xFFFF, 0);
+  }
+  else if (!strcmp(word, "status")) {
+    logLine("state %d, file %02d/%03d (%d), volume %d, EQ %d, card %s, files %d",
+            state, currentFolder, currentFile, currentIndex, volume, eq, cardInserted ? "in" : "out", fileCount());
+  }
+  else if (!strcmp(word, "quit")) {
+    return false;
+  }
+  else {
+    printf("commands: remove, insert, finish, error <code>, send <0xCCPPPP>, status, quit\n");
+  }
+  return true;
+}
+
+////////////////////////////////// MAIN ///////////////////////////////////
+
+static void usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  -f folder:files   folder of the card, e.g. -f 1:1-12 -f 51:1-9,20-22,255 (repeatable)\n"
+         "  -s ms             SD seek delay (default %ld)\n"
+         "  -a ms             ACK delay (default %ld)\n"
+         "  -j ms             reply jitter (default %ld)\n"
+         "  -t ms             length of a file (default %ld)\n"
+         "  -r ms             reset time (default %ld)\n"
+         "  -x probability    dropped byte (default 0)\n"
+         "  -c probability    corrupted byte (default 0)\n"
+         "  -S seed           random seed (default 1)\n"
+         "  -d device         serial port instead of the pty, RTS is BUSY\n"
+         "  -l path           symlink to the pty\n"
+         "  -v                log all received bytes\n",
+         name, options.seek, options.ackDelay, options.jitter, options.track, options.resetDelay);
+}
+
+/// @brief Opens the pty master (raw mode) or the serial port (9600 8N1)
+static bool openPort() {
+  if (!options.device.empty()) {
+    port = open(options.device.c_str(), O_RDWR | O_NOCTTY);
+    realPort = true;
+  }
+  else {
+    port = posix_openpt(O_RDWR | O_NOCTTY);
+    if (port >= 0 && (grantpt(port) || unlockpt(port))) return false;
+  }
+  if (port < 0) return false;
+
+  struct termios tio;
+  tcgetattr(port, &tio);
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B9600);
+  cfsetospeed(&tio, B9600);
+  tcsetattr(port, TCSANOW, &tio);
+
+  if (!realPort) {
+    const char *name = ptsname(port);
+    // keep the slave open - the master does not get EIO when the client disconnects
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave >= 0) {
+      tcgetattr(slave, &tio);
+      cfmakeraw(&tio);
+      tcsetattr(slave, TCSANOW, &tio);
+    }
+    printf("DFPlayer emulator on %s\n", name);
+    if (!options.link.empty()) {
+      unlink(options.link.c_str());
+      if (symlink(name, options.link.c_str())) perror("symlink");
+      else printf("linked as %s\n", options.link.c_str());
+    }
+  }
+  else {
+    printf("DFPlayer emulator on %s, RTS = BUSY\n", options.device.c_str());
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int option;
+  while ((option = getopt(argc, argv, "f:s:a:j:t:r:x:c:S:d:l:vh")) != -1) {
+    switch (option) {
+      case 'f':
+        if (!parseFolder(optarg)) {
+          fprintf(stderr, "wrong folder: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 's': options.seek = atol(optarg); break;
+      case 'a': options.ackDelay = atol(optarg); break;
+      case 'j': options.jitter = atol(optarg); break;
+      case 't': options.track = atol(optarg); break;
+      case 'r': options.resetDelay = atol(optarg); break;
+      case 'x': options.drop = atof(optarg); break;
+      case 'c': options.corrupt = atof(optarg); break;
+      case 'S': options.seed = atoi(optarg); break;
+      case 'd': options.device = optarg; break;
+      case 'l': options.link = optarg; break;
+      case 'v': options.verbose = true; break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+
+  if (tree.empty()) { // TinTinNabulum card: ringtones and messages
+    parseFolder("1:1-12");
+    parseFolder("2:1-5");
+    parseFolder("3:1");
+    parseFolder("51:1-9,20-22,30,40-43,91-93,140,255");
+  }
+
+  rng.seed(options.seed);
+  start = Clock::now();
+  lastTx = start;
+  receivedTime = start;
+
+  if (!openPort()) {
+    perror("port");
+    return 1;
+  }
+  printf("card: %d files in %zu folders; type 'help' for console commands\n", fileCount(), tree.size());
+  fflush(stdout);
+
+  sendFrame(0x3F, 0x02, options.resetDelay); // power on: the card is online
+
+  bool running = true;
+  bool consoleOpen = true;
+  while (running) {
+    int timeout = -1;
+    if (!timeline.empty()) {
+      long wait = std::chrono::duration_cast<std::chrono::milliseconds>(timeline.begin()->first - Clock::now()).count();
+      timeout = wait < 0 ? 0 : wait + 1;
+    }
+
+    struct pollfd fds[2] = {{port, POLLIN, 0}, {consoleOpen ? STDIN_FILENO : -1, POLLIN, 0}};
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) break;
+
+    if (fds[0].revents & POLLIN) {
+      uint8_t buffer[64];
+      ssize_t length = read(port, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < length; i++) receiveByte(buffer[i]);
+    }
+    if (fds[1].revents & POLLIN) {
+      char line[128];
+      if (!fgets(line, sizeof(line), stdin)) consoleOpen = false;
+      else running = console(line);
+    }
+
+    while (!timeline.empty() && timeline.begin()->first <= Clock::now()) {
+      auto action = timeline.begin()->second;
+      timeline.erase(timeline.begin());
+      action();
+    }
+  }
+
+  if (!options.link.empty()) unlink(options.link.c_str());
+  return 0;
+}